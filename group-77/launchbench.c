@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+// Launch latency benchmark for simple-shell. Drives an interactive shell over pipes and
+// times each line from write() until a marker printed by the launched command comes back:
+//   builtin    echo                             (floor: parse + builtin + pipe round trip)
+//   plain      launchbench --probe              (PATH lookup + posix_spawn + wait)
+//   redirect   launchbench --probe < f 2> f     (plus openRedirections)
+//   pipeN      launchbench --probe | /bin/cat... (N stages in one process group)
+//   submit     submit launchbench --probe-sched (fork + shm publish + first SIGUSR1)
+// Each history size and heap size gets a fresh shell, with a synthetic history file of that
+// many entries and that many MB of touched heap (SIMPLE_SHELL_BALLAST_MB). plain and
+// redirect should stay flat as rss_kb grows; submit still forks and shows what they avoid.
+//
+//   gcc -O2 -o simple simple-shell.c -lpthread && gcc -O2 -o s simple-scheduler.c
+//   gcc -O2 -o launchbench launchbench.c && ./launchbench -H 0,100000,1000000
+//   ./launchbench -M 0,128,512,2048 -n 300
+//
+// Run it from the directory holding s, which the shell launches as ./s.
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_WARMUP 50
+#define MARKER_TIMEOUT_MS 10000
+#define MAX_CONFIGS 16
+#define MAX_STAGES 16
+
+// HDR-style histogram: 2^SUB_BITS linear sub-buckets per power of two, so any recorded
+// value is off by at most 1/64 (about 1.6%) from nanoseconds up to minutes
+#define SUB_BITS 6
+#define SUB_COUNT (1 << SUB_BITS)
+#define OCTAVES 40
+
+typedef struct {
+    unsigned long long counts[OCTAVES][SUB_COUNT];
+    unsigned long long total;
+    long long min;
+    long long max;
+    double sum;
+} Histogram;
+
+void hist_record(Histogram *h, long long ns) {
+    if (ns < 0) ns = 0;
+    int octave = 0;
+    long long v = ns;
+    while (v >= SUB_COUNT * 2 && octave < OCTAVES - 1) {
+        v >>= 1;
+        octave++;
+    }
+    // Octave 0 is linear over [0, 2*SUB_COUNT); later ones keep the top SUB_BITS bits
+    int sub = octave == 0 ? (int)(v >> 1) : (int)(v - SUB_COUNT);
+    if (sub >= SUB_COUNT) sub = SUB_COUNT - 1;
+    h->counts[octave][sub]++;
+    if (h->total == 0 || ns < h->min) h->min = ns;
+    if (ns > h->max) h->max = ns;
+    h->total++;
+    h->sum += ns;
+}
+
+// Upper edge of a bucket, so percentiles never under-report
+long long bucket_value(int octave, int sub) {
+    if (octave == 0) return (long long)(sub + 1) * 2 - 1;
+    return ((long long)(SUB_COUNT + sub + 1) << octave) - 1;
+}
+
+long long hist_percentile(const Histogram *h, double pct) {
+    if (h->total == 0) return 0;
+    unsigned long long rank = (unsigned long long)(pct / 100.0 * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    unsigned long long seen = 0;
+    for (int o = 0; o < OCTAVES; o++) {
+        for (int s = 0; s < SUB_COUNT; s++) {
+            seen += h->counts[o][s];
+            if (seen >= rank) {
+                long long v = bucket_value(o, s);
+                return v < h->max ? v : h->max;
+            }
+        }
+    }
+    return h->max;
+}
+
+void hist_dump(const Histogram *h) {
+    unsigned long long seen = 0;
+    for (int o = 0; o < OCTAVES; o++) {
+        for (int s = 0; s < SUB_COUNT; s++) {
+            if (h->counts[o][s] == 0) continue;
+            seen += h->counts[o][s];
+            printf("    <= %10.1f us  %8llu  %7.3f%%\n", bucket_value(o, s) / 1000.0,
+                   h->counts[o][s], 100.0 * seen / h->total);
+        }
+    }
+}
+
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// --probe MARK: prints the marker and exits
+// --probe-sched MARK: waits for the scheduler's first SIGUSR1 like dummy_main.h, then
+// prints the marker with the time the signal arrived
+volatile sig_atomic_t started = 0;
+long long start_ns = 0;
+
+void probe_handler(int sig) {
+    if (sig == SIGUSR1 && !started) {
+        start_ns = now_ns();
+        started = 1;
+    }
+}
+
+int run_probe(int sched, const char *mark) {
+    if (!sched) {
+        printf("%s\n", mark);
+        return 0;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = probe_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    // The shell starts jobs with both signals blocked; an early SIGUSR1 stays pending
+    sigset_t mask, wait_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, &wait_mask);
+    sigdelset(&wait_mask, SIGUSR1);
+    sigdelset(&wait_mask, SIGUSR2);
+    while (!started) sigsuspend(&wait_mask);
+    printf("%s %lld\n", mark, start_ns);
+    return 0;
+}
+
+// The shell under test, started interactively with its stdin and stdout on pipes
+pid_t shell_pid;
+int shell_in = -1;
+int shell_out = -1;
+char out_buf[1 << 16];
+size_t out_len = 0;
+
+int start_shell(const char *shell, const char *histfile, long ballast_mb, const char *ncpu, const char *tslice) {
+    int in[2], out[2];
+    if (pipe(in) == -1 || pipe(out) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    shell_pid = fork();
+    if (shell_pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null != -1) dup2(null, STDERR_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        setenv("SIMPLE_SHELL_HISTFILE", histfile, 1);
+        char mb[32];
+        snprintf(mb, sizeof(mb), "%ld", ballast_mb);
+        setenv("SIMPLE_SHELL_BALLAST_MB", mb, 1);
+        execl(shell, shell, ncpu, tslice, (char *)NULL);
+        perror("exec shell");
+        _exit(127);
+    }
+    if (shell_pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    close(in[0]);
+    close(out[1]);
+    shell_in = in[1];
+    shell_out = out[0];
+    out_len = 0;
+    return 0;
+}
+
+// Reads shell output until a line contains mark; returns the time it arrived, and
+// the number printed after the marker in *value when value is not NULL
+long long wait_marker(const char *mark, long long *value) {
+    size_t mark_len = strlen(mark);
+    long long deadline = now_ns() + MARKER_TIMEOUT_MS * 1000000LL;
+    while (1) {
+        char *nl;
+        while ((nl = memchr(out_buf, '\n', out_len)) != NULL) {
+            *nl = '\0';
+            char *hit = strstr(out_buf, mark);
+            long long t = now_ns();
+            if (hit != NULL && value != NULL) *value = atoll(hit + mark_len);
+            size_t used = nl + 1 - out_buf;
+            memmove(out_buf, nl + 1, out_len - used);
+            out_len -= used;
+            if (hit != NULL) return t;
+        }
+        if (out_len == sizeof(out_buf)) out_len = 0;  // a line this long is not ours
+
+        struct pollfd p = { shell_out, POLLIN, 0 };
+        int left = (int)((deadline - now_ns()) / 1000000);
+        if (left <= 0 || poll(&p, 1, left) <= 0) {
+            fprintf(stderr, "launchbench: timed out waiting for %s\n", mark);
+            return -1;
+        }
+        ssize_t n = read(shell_out, out_buf + out_len, sizeof(out_buf) - out_len);
+        if (n <= 0) {
+            fprintf(stderr, "launchbench: shell exited while waiting for %s\n", mark);
+            return -1;
+        }
+        out_len += n;
+    }
+}
+
+int send_line(const char *line) {
+    size_t len = strlen(line);
+    return write(shell_in, line, len) == (ssize_t)len ? 0 : -1;
+}
+
+void stop_shell() {
+    send_line("exit\n");
+    close(shell_in);
+    // Drain the exit summary so the shell never blocks on a full pipe
+    char buf[65536];
+    while (read(shell_out, buf, sizeof(buf)) > 0) {}
+    close(shell_out);
+    waitpid(shell_pid, NULL, 0);
+}
+
+long shell_rss_kb() {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", shell_pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    long kb = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+// Deterministic history so runs on different machines read the same file
+int write_history(const char *path, long entries) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    unsigned int seed = 12345;
+    for (long i = 0; i < entries; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(f, "submit ./job%u %u -- --input data/%ld.txt\n", seed % 97, 1 + seed % 4, i);
+    }
+    fclose(f);
+    // Make the shell build its offset index itself
+    char idx[PATH_MAX];
+    snprintf(idx, sizeof(idx), "%s.idx", path);
+    unlink(idx);
+    return 0;
+}
+
+enum { PATH_BUILTIN, PATH_PLAIN, PATH_REDIRECT, PATH_PIPE, PATH_SUBMIT };
+
+typedef struct {
+    const char *name;
+    int kind;
+    int stages;
+} BenchPath;
+
+// One timed line; returns latency in ns, or -1 if the marker never came back
+long long run_once(const BenchPath *bp, const char *self, long seq) {
+    char mark[32], line[1024];
+    snprintf(mark, sizeof(mark), "@%ld@", seq);
+    int n;
+    if (bp->kind == PATH_BUILTIN) {
+        n = snprintf(line, sizeof(line), "echo %s\n", mark);
+    } else if (bp->kind == PATH_PLAIN) {
+        n = snprintf(line, sizeof(line), "launchbench --probe %s\n", mark);
+    } else if (bp->kind == PATH_REDIRECT) {
+        n = snprintf(line, sizeof(line), "launchbench --probe %s < /dev/null 2> /dev/null\n", mark);
+    } else if (bp->kind == PATH_PIPE) {
+        n = snprintf(line, sizeof(line), "launchbench --probe %s", mark);
+        for (int i = 1; i < bp->stages; i++) n += snprintf(line + n, sizeof(line) - n, " | /bin/cat");
+        n += snprintf(line + n, sizeof(line) - n, "\n");
+    } else {
+        n = snprintf(line, sizeof(line), "submit %s -- --probe-sched %s\n", self, mark);
+    }
+    (void)n;
+
+    long long t0 = now_ns();
+    if (send_line(line) == -1) return -1;
+    long long value = 0;
+    long long t1 = wait_marker(mark, bp->kind == PATH_SUBMIT ? &value : NULL);
+    if (t1 < 0) return -1;
+    // For submit the interesting end is the first SIGUSR1, stamped by the probe itself
+    return bp->kind == PATH_SUBMIT ? value - t0 : t1 - t0;
+}
+
+int parse_list(const char *arg, long *out, int max) {
+    int n = 0;
+    char *copy = strdup(arg);
+    for (char *tok = strtok(copy, ","); tok != NULL && n < max; tok = strtok(NULL, ",")) {
+        out[n++] = atol(tok);
+    }
+    free(copy);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "--probe") == 0) return run_probe(0, argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "--probe-sched") == 0) return run_probe(1, argv[2]);
+
+    const char *shell = "./simple";
+    const char *ncpu = "1";
+    const char *tslice = "1000";
+    long iterations = DEFAULT_ITERATIONS;
+    long warmup = DEFAULT_WARMUP;
+    long hist_sizes[MAX_CONFIGS] = { 0 };
+    int hist_count = 1;
+    long heap_sizes[MAX_CONFIGS] = { 0 };
+    int heap_count = 1;
+    long stage_list[MAX_CONFIGS] = { 2, 4 };
+    int stage_count = 2;
+    int verbose = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:t:n:w:H:M:p:v")) != -1) {
+        if (opt == 's') shell = optarg;
+        else if (opt == 'c') ncpu = optarg;
+        else if (opt == 't') tslice = optarg;
+        else if (opt == 'n') iterations = atol(optarg);
+        else if (opt == 'w') warmup = atol(optarg);
+        else if (opt == 'H') hist_count = parse_list(optarg, hist_sizes, MAX_CONFIGS);
+        else if (opt == 'M') heap_count = parse_list(optarg, heap_sizes, MAX_CONFIGS);
+        else if (opt == 'p') stage_count = parse_list(optarg, stage_list, MAX_CONFIGS);
+        else if (opt == 'v') verbose = 1;
+        else {
+            fprintf(stderr, "Usage: %s [-s SHELL] [-c NCPU] [-t TSLICE] [-n ITERATIONS] [-w WARMUP] [-H HIST,...] [-M MB,...] [-p STAGES,...] [-v]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    // The probe is launched by bare name, so the shell resolves it through PATH
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0) {
+        perror("readlink /proc/self/exe");
+        return 1;
+    }
+    self[len] = '\0';
+    char dir[PATH_MAX], new_path[PATH_MAX * 2];
+    snprintf(dir, sizeof(dir), "%s", self);
+    *strrchr(dir, '/') = '\0';
+    snprintf(new_path, sizeof(new_path), "%s:%s", dir, getenv("PATH") != NULL ? getenv("PATH") : "/usr/bin:/bin");
+    setenv("PATH", new_path, 1);
+    char probe_link[PATH_MAX + 16];
+    snprintf(probe_link, sizeof(probe_link), "%s/launchbench", dir);
+    if (access(probe_link, X_OK) == -1) {
+        fprintf(stderr, "launchbench: %s must be named launchbench\n", self);
+        return 1;
+    }
+
+    BenchPath paths[4 + MAX_CONFIGS];
+    char stage_names[MAX_CONFIGS][16];
+    int path_count = 0;
+    paths[path_count++] = (BenchPath){ "builtin", PATH_BUILTIN, 1 };
+    paths[path_count++] = (BenchPath){ "plain", PATH_PLAIN, 1 };
+    paths[path_count++] = (BenchPath){ "redirect", PATH_REDIRECT, 1 };
+    for (int i = 0; i < stage_count; i++) {
+        int stages = stage_list[i] < 2 ? 2 : stage_list[i] > MAX_STAGES ? MAX_STAGES : stage_list[i];
+        snprintf(stage_names[i], sizeof(stage_names[i]), "pipe%d", stages);
+        paths[path_count++] = (BenchPath){ stage_names[i], PATH_PIPE, stages };
+    }
+    paths[path_count++] = (BenchPath){ "submit", PATH_SUBMIT, 1 };
+
+    struct utsname u;
+    uname(&u);
+    printf("launchbench: %s %s, %ld CPUs, %s NCPU=%s TSLICE=%s, %ld iterations (+%ld warmup) per path\n",
+           u.sysname, u.release, sysconf(_SC_NPROCESSORS_ONLN), shell, ncpu, tslice, iterations, warmup);
+    printf("%-9s %-7s %-9s %-9s %8s %10s %10s %10s %10s %10s %10s\n", "history", "heap_mb", "rss_kb", "path",
+           "n", "mean_us", "p50_us", "p99_us", "p999_us", "max_us", "ops/s");
+
+    signal(SIGPIPE, SIG_IGN);
+    char histfile[] = "/tmp/launchbench-history-XXXXXX";
+    int hist_fd = mkstemp(histfile);
+    if (hist_fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(hist_fd);
+
+    long seq = 0;
+    int failed = 0;
+    Histogram *h = malloc(sizeof(Histogram));
+    for (int c = 0; c < hist_count * heap_count && !failed; c++) {
+        long entries = hist_sizes[c / heap_count], heap_mb = heap_sizes[c % heap_count];
+        if (c % heap_count == 0 && write_history(histfile, entries) == -1) break;
+        if (start_shell(shell, histfile, heap_mb, ncpu, tslice) == -1) break;
+
+        // First line also waits out shell startup (history scan, scheduler launch)
+        char line[64];
+        snprintf(line, sizeof(line), "echo @%ld@\n", ++seq);
+        send_line(line);
+        snprintf(line, sizeof(line), "@%ld@", seq);
+        if (wait_marker(line, NULL) < 0) {
+            failed = 1;
+            stop_shell();
+            break;
+        }
+
+        long rss = shell_rss_kb();
+        for (int p = 0; p < path_count && !failed; p++) {
+            memset(h, 0, sizeof(*h));
+            for (long i = 0; i < warmup && !failed; i++) {
+                if (run_once(&paths[p], self, ++seq) < 0) failed = 1;
+            }
+            long long start = now_ns();
+            for (long i = 0; i < iterations && !failed; i++) {
+                long long ns = run_once(&paths[p], self, ++seq);
+                if (ns < 0) failed = 1;
+                else hist_record(h, ns);
+            }
+            double secs = (now_ns() - start) / 1e9;
+            if (failed) break;
+            printf("%-9ld %-7ld %-9ld %-9s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.0f\n",
+                   entries, heap_mb, rss, paths[p].name, h->total, h->sum / h->total / 1000.0,
+                   hist_percentile(h, 50) / 1000.0, hist_percentile(h, 99) / 1000.0,
+                   hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0, h->total / secs);
+            if (verbose) hist_dump(h);
+            fflush(stdout);
+        }
+        stop_shell();
+    }
+
+    free(h);
+    unlink(histfile);
+    char idx[PATH_MAX];
+    snprintf(idx, sizeof(idx), "%s.idx", histfile);
+    unlink(idx);
+    return failed;
+}
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+#include "shared_memory.h"
+
+// Offline replay of simple-scheduler's queue and dispatch logic. The real scheduler code
+// (built with -DSCHEDULER_SIM) runs against a simulated clock: signals become state
+// changes here, and the job table is an ordinary heap copy of the shell's segment.
+//
+//   gcc -O2 -DSCHEDULER_SIM -o sched-sim sched-sim.c simple-scheduler.c -lm
+//   ./sched-sim -c 4 -t 1000 -g 1000000          synthetic trace
+//   ./sched-sim -c 4 -t 1000 -f jobs.trace       recorded trace
+//   ./sched-sim -c 4 -t auto -g 1000000          TSLICE autotune (SCHED_TSLICE_OVERHEAD)
+//   ./sched-sim -c 4 -t auto -k 5000 -g 1000000  autotune with ticks costing 5 us
+//
+// Every clock the scheduler reads is the simulated one, and a tick is charged a fixed
+// cost (-k, in ns) rather than measured, so the same trace or seed always prints the same
+// report; the host time the replay took goes to stderr. To check:
+//
+//   ./sched-sim -c 4 -t auto -g 200000 -S 7 | md5sum     twice, same sum
+//
+// Trace lines are "arrival_us priority [after=N,...] cpu_us [io_us cpu_us ...]": CPU bursts
+// alternate with I/O waits. CPU only advances while the job holds a slot; I/O advances
+// regardless. after= names earlier lines (1-based) the job waits for, like submit --after.
+
+#define DEFAULT_NCPU "1"
+#define DEFAULT_TSLICE_US 1000
+#define DEFAULT_INTERARRIVAL_US 2000
+#define DEFAULT_BURST_US 5000
+#define DEFAULT_IO_US 3000
+#define DEFAULT_IO_FRACTION 0.2
+#define DEFAULT_TICK_NS 2000
+
+enum {
+    SIM_PENDING,
+    SIM_LIVE,
+    SIM_DONE
+};
+
+typedef struct {
+    long long arrival;
+    int priority;
+    int seg_first;   // index into segments; even offsets are CPU, odd are I/O
+    int seg_count;
+    int seg;
+    long long remaining;  // of the current segment
+    long long cpu_total;
+    long long io_total;
+    long long first_run;  // -1 until first dispatched
+    long long finish;
+    int state;
+    int dispatched;
+    int slot;  // index into shared_mem->jobs while live
+    int dep_first;  // index into deps
+    int dep_count;
+    int cancelled;
+} SimJob;
+
+SimJob *jobs = NULL;
+size_t job_total = 0, job_cap = 0;
+long long *segments = NULL;
+size_t seg_total = 0, seg_cap = 0;
+pid_t *deps = NULL;
+size_t dep_total = 0, dep_cap = 0;
+
+long long sim_now_us = 0;
+int sim_verbose = 0;
+long long sim_tick_ns = DEFAULT_TICK_NS;
+
+void sim_resume(pid_t pid) {
+    SimJob *j = &jobs[pid - 1];
+    j->dispatched = 1;
+    if (j->first_run < 0) j->first_run = sim_now_us;
+}
+
+void sim_pause(pid_t pid) {
+    jobs[pid - 1].dispatched = 0;
+}
+
+int sim_alive(pid_t pid) {
+    return pid >= 1 && (size_t)pid <= job_total && jobs[pid - 1].state != SIM_DONE;
+}
+
+void sim_clock(struct timespec *ts) {
+    ts->tv_sec = sim_now_us / 1000000;
+    ts->tv_nsec = (sim_now_us % 1000000) * 1000;
+}
+
+SimJob *add_job(long long arrival, int priority) {
+    if (job_total == job_cap) {
+        job_cap = job_cap ? job_cap * 2 : 1024;
+        jobs = realloc(jobs, job_cap * sizeof(SimJob));
+        if (jobs == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    SimJob *j = &jobs[job_total++];
+    memset(j, 0, sizeof(*j));
+    j->arrival = arrival;
+    j->priority = priority;
+    j->seg_first = seg_total;
+    j->dep_first = dep_total;
+    j->first_run = -1;
+    return j;
+}
+
+void add_segment(SimJob *j, long long us) {
+    if (seg_total == seg_cap) {
+        seg_cap = seg_cap ? seg_cap * 2 : 4096;
+        segments = realloc(segments, seg_cap * sizeof(long long));
+        if (segments == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    segments[seg_total++] = us;
+    if (j->seg_count % 2 == 0) j->cpu_total += us;
+    else j->io_total += us;
+    j->seg_count++;
+}
+
+int add_dependency(SimJob *j, long parent) {
+    if (parent < 1 || parent >= j - jobs + 1 || j->dep_count == MAX_JOB_DEPS) return -1;
+    if (dep_total == dep_cap) {
+        dep_cap = dep_cap ? dep_cap * 2 : 1024;
+        deps = realloc(deps, dep_cap * sizeof(pid_t));
+        if (deps == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    deps[dep_total++] = parent;
+    j->dep_count++;
+    return 0;
+}
+
+int load_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror("Cannot open trace");
+        return -1;
+    }
+    char line[4096];
+    long long last_arrival = 0;
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        char *end;
+        long long arrival = strtoll(p, &end, 10);
+        long priority = end != p ? strtol(end, &p, 10) : 0;
+        if (end == p || arrival < last_arrival || priority < 1 || priority > MAX_PRIORITY) {
+            fprintf(stderr, "%s:%d: expected 'arrival_us priority cpu_us ...' in arrival order\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        last_arrival = arrival;
+        SimJob *j = add_job(arrival, priority);
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncmp(p, "after=", 6) == 0) {
+            p += 6;
+            do {
+                if (add_dependency(j, strtol(p, &end, 10)) == -1 || end == p) {
+                    fprintf(stderr, "%s:%d: after= takes up to %d earlier line numbers\n", path, lineno, MAX_JOB_DEPS);
+                    fclose(f);
+                    return -1;
+                }
+                p = end;
+            } while (*p++ == ',');
+        }
+        while (1) {
+            long long us = strtoll(p, &end, 10);
+            if (end == p) break;
+            add_segment(j, us < 0 ? 0 : us);
+            p = end;
+        }
+        if (j->seg_count == 0) add_segment(j, 0);
+    }
+    fclose(f);
+    return 0;
+}
+
+// xorshift64*: the same seed always gives the same trace
+unsigned long long rng_state = 88172645463325252ULL;
+
+double rng_uniform() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+long long rng_exponential(double mean) {
+    return (long long)(-mean * log(1.0 - rng_uniform()));
+}
+
+void generate_trace(long count, double interarrival, double burst, double io_fraction, double io_mean) {
+    long long arrival = 0;
+    for (long i = 0; i < count; i++) {
+        arrival += rng_exponential(interarrival);
+        SimJob *j = add_job(arrival, 1 + (int)(rng_uniform() * MAX_PRIORITY));
+        add_segment(j, 1 + rng_exponential(burst));
+        while (rng_uniform() < io_fraction && j->seg_count < 16) {
+            add_segment(j, 1 + rng_exponential(io_mean));
+            add_segment(j, 1 + rng_exponential(burst));
+        }
+    }
+}
+
+int write_trace(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror("Cannot write trace");
+        return -1;
+    }
+    fprintf(f, "# arrival_us priority [after=N,...] cpu_us [io_us cpu_us ...]\n");
+    for (size_t i = 0; i < job_total; i++) {
+        fprintf(f, "%lld %d", jobs[i].arrival, jobs[i].priority);
+        for (int d = 0; d < jobs[i].dep_count; d++) {
+            fprintf(f, "%s%d", d == 0 ? " after=" : ",", deps[jobs[i].dep_first + d]);
+        }
+        for (int s = 0; s < jobs[i].seg_count; s++) {
+            fprintf(f, " %lld", segments[jobs[i].seg_first + s]);
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return 0;
+}
+
+// Jobs currently in the shell's table
+int live[MAX_JOBS];
+int live_count = 0;
+size_t next_arrival = 0;
+size_t done_count = 0;
+long long busy_slot_us = 0;
+long long cpu_used_us = 0;
+
+void finish_job(int idx, long long when) {
+    SimJob *j = &jobs[idx];
+    j->state = SIM_DONE;
+    j->finish = when;
+    j->dispatched = 0;
+    // What the shell's reaper does when the child exits
+    SharedJob *shared = &shared_mem->jobs[j->slot];
+    shared->exit_status = j->cancelled ? 128 + SIGTERM : 0;
+    shared->completed = 1;
+    shared->end_time = when / 1000000;
+    done_count++;
+}
+
+// A job whose parent failed dies as soon as the scheduler sends SIGTERM
+void sim_cancel(pid_t pid) {
+    jobs[pid - 1].cancelled = 1;
+    finish_job(pid - 1, sim_now_us);
+}
+
+// Runs one job for dt microseconds of simulated time starting at sim_now_us
+int advance_job(int idx, long long dt) {
+    SimJob *j = &jobs[idx];
+    if (j->state == SIM_DONE) return 1;
+    long long t = 0;
+    int held = j->dispatched;
+    while (1) {
+        if (j->remaining == 0) {
+            if (j->seg == j->seg_count) {
+                if (held) busy_slot_us += t;
+                finish_job(idx, sim_now_us + t);
+                return 1;
+            }
+            j->remaining = segments[j->seg_first + j->seg];
+            j->seg++;
+            continue;
+        }
+        if (t == dt) break;
+        int on_cpu = (j->seg - 1) % 2 == 0;
+        if (on_cpu && !j->dispatched) break;
+        long long step = j->remaining < dt - t ? j->remaining : dt - t;
+        j->remaining -= step;
+        t += step;
+        if (on_cpu) cpu_used_us += step;
+    }
+    if (held) busy_slot_us += dt;
+    return 0;
+}
+
+// Fills free table entries with arrivals that are due, like handle_submit would
+void admit_arrivals() {
+    int slot = 0;
+    while (next_arrival < job_total && jobs[next_arrival].arrival <= sim_now_us && live_count < MAX_JOBS) {
+        while (slot < shared_mem->job_count && !shared_slot_free(shared_mem, slot)) slot++;
+        if (slot == shared_mem->job_count) {
+            if (shared_mem->job_count == MAX_JOBS) break;
+            shared_mem->job_count++;
+        }
+        SimJob *j = &jobs[next_arrival];
+        SharedJob *shared = &shared_mem->jobs[slot];
+        memset(shared, 0, sizeof(*shared));
+        shared->job_pid = next_arrival + 1;
+        snprintf(shared->name, sizeof(shared->name), "job%zu", next_arrival + 1);
+        shared->priority = j->priority;
+        shared->start_time = j->arrival / 1000000;
+        // Parents that already exited 0 are left out, as the shell does
+        for (int d = 0; d < j->dep_count; d++) {
+            SimJob *parent = &jobs[deps[j->dep_first + d] - 1];
+            if (parent->state != SIM_DONE || parent->cancelled) shared->after[shared->after_count++] = parent - jobs + 1;
+        }
+        shared->is_new = 1;
+        j->slot = slot;
+        j->state = SIM_LIVE;
+        live[live_count++] = next_arrival;
+        next_arrival++;
+    }
+}
+
+void run() {
+    if (job_total > 0) sim_now_us = jobs[0].arrival;
+    while (done_count < job_total) {
+        admit_arrivals();
+        schedule_processes();
+
+        if (live_count == 0) {
+            // Nothing to run: the scheduler sleeps until the next submit
+            sim_now_us = jobs[next_arrival].arrival;
+            continue;
+        }
+
+        for (int i = 0; i < live_count; ) {
+            if (advance_job(live[i], tslice)) live[i] = live[--live_count];
+            else i++;
+        }
+        // tslice may have been changed by autotune during the tick
+        sim_now_us += tslice;
+    }
+    // One more tick so the scheduler notices the last completions
+    schedule_processes();
+}
+
+int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts values in place and prints mean/p50/p99/max in milliseconds
+void print_distribution(const char *label, long long *values, size_t n) {
+    if (n == 0) {
+        printf("%-12s %10s\n", label, "-");
+        return;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += values[i];
+    qsort(values, n, sizeof(long long), compare_ll);
+    printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", label, sum / n / 1000.0,
+           values[n / 2] / 1000.0, values[(size_t)(n * 0.99)] / 1000.0, values[n - 1] / 1000.0);
+}
+
+void report() {
+    SchedStats st;
+    sched_stats_read(&shared_mem->stats, &st);
+    long long makespan = 0;
+    if (job_total > 0) {
+        for (size_t i = 0; i < job_total; i++) {
+            if (jobs[i].finish > makespan) makespan = jobs[i].finish;
+        }
+        makespan -= jobs[0].arrival;
+    }
+
+    printf("sched-sim: %zu jobs  ncpu %d  tslice %d us  simulated %.3f s  tick cost %lld ns\n",
+           job_total, st.ncpu, st.tslice_us, makespan / 1e6, sim_tick_ns);
+    printf("ticks %llu  dispatches %llu  preemptions %llu  completions %llu  tick avg %.1f us  max %.1f us\n",
+           st.ticks, st.dispatches, st.preemptions, st.completions,
+           st.ticks ? st.tick_ns_total / (double)st.ticks / 1000.0 : 0.0, st.tick_ns_max / 1000.0);
+    double slot_time = (double)makespan * st.ncpu;
+    printf("throughput %.1f jobs/s  dispatch rate %.1f/s  slot utilisation %.1f%%  cpu utilisation %.1f%%\n",
+           makespan ? job_total * 1e6 / makespan : 0.0, st.dispatch_rate,
+           slot_time ? 100.0 * busy_slot_us / slot_time : 0.0,
+           slot_time ? 100.0 * cpu_used_us / slot_time : 0.0);
+    if (st.tslice_auto) {
+        printf("tslice auto: %llu adjustments; last window overhead %.2f%%, p99 wait %lld us\n",
+               st.tslice_changes, st.overhead_pct, st.wait_p99_us);
+    }
+
+    long long *turnaround = malloc(job_total * sizeof(long long));
+    long long *wait = malloc(job_total * sizeof(long long));
+    long long *response = malloc(job_total * sizeof(long long));
+    if (turnaround == NULL || wait == NULL || response == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    // Priority 0 collects every job
+    for (int p = 0; p <= MAX_PRIORITY; p++) {
+        size_t n = 0;
+        for (size_t i = 0; i < job_total; i++) {
+            SimJob *j = &jobs[i];
+            if (p != 0 && j->priority != p) continue;
+            turnaround[n] = j->finish - j->arrival;
+            // Time spent runnable but without a slot, or waiting for a free table entry
+            wait[n] = turnaround[n] - j->cpu_total - j->io_total;
+            response[n] = (j->first_run < 0 ? j->finish : j->first_run) - j->arrival;
+            n++;
+        }
+        if (n == 0) continue;
+        char label[32];
+        if (p == 0) snprintf(label, sizeof(label), "all jobs");
+        else snprintf(label, sizeof(label), "priority %d", p);
+        printf("\n%-12s %10s %10s %10s %10s   (ms, %zu jobs)\n", label, "mean", "p50", "p99", "max", n);
+        print_distribution("turnaround", turnaround, n);
+        print_distribution("wait", wait, n);
+        print_distribution("response", response, n);
+    }
+    size_t cancelled = 0;
+    for (size_t i = 0; i < job_total; i++) cancelled += jobs[i].cancelled;
+    if (cancelled > 0) printf("\n%zu jobs cancelled because a job they ran after failed\n", cancelled);
+    free(turnaround);
+    free(wait);
+    free(response);
+
+    if (sim_verbose) {
+        printf("\nScheduler Job Statistics:\n");
+        printf("%-20s %-10s %-10s %-20s %-20s\n",
+               "Name", "PID", "Priority", "Completion Time", "Wait Time");
+        for (size_t i = 0; i < job_total; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "job%zu", i + 1);
+            printf("%-20s %-10zu %-10d %-20.2f %-20.2f\n", name, i + 1, jobs[i].priority,
+                   (jobs[i].finish - jobs[i].arrival) / 1000.0,
+                   (jobs[i].finish - jobs[i].arrival - jobs[i].cpu_total - jobs[i].io_total) / 1000.0);
+        }
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c NCPU] [-t TSLICE_US|auto] [-k TICK_NS] (-f TRACE | -g JOBS [-a INTERARRIVAL_US] [-b BURST_US]\n"
+                    "       [-i IO_FRACTION] [-o IO_US] [-S SEED] [-w TRACE_OUT]) [-v]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *ncpu_str = DEFAULT_NCPU;
+    int tslice_us = DEFAULT_TSLICE_US;
+    const char *trace_path = NULL, *trace_out = NULL;
+    long generate = 0;
+    double interarrival = DEFAULT_INTERARRIVAL_US, burst = DEFAULT_BURST_US;
+    double io_fraction = DEFAULT_IO_FRACTION, io_mean = DEFAULT_IO_US;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:k:f:g:a:b:i:o:S:w:v")) != -1) {
+        if (opt == 'c') ncpu_str = optarg;
+        else if (opt == 't') tslice_us = strcmp(optarg, "auto") == 0 ? 0 : atoi(optarg) > 0 ? atoi(optarg) : -1;
+        else if (opt == 'k') sim_tick_ns = atoll(optarg) >= 0 ? atoll(optarg) : -1;
+        else if (opt == 'f') trace_path = optarg;
+        else if (opt == 'g') generate = atol(optarg);
+        else if (opt == 'a') interarrival = atof(optarg);
+        else if (opt == 'b') burst = atof(optarg);
+        else if (opt == 'i') io_fraction = atof(optarg);
+        else if (opt == 'o') io_mean = atof(optarg);
+        else if (opt == 'S') rng_state = strtoull(optarg, NULL, 0) | 1;
+        else if (opt == 'w') trace_out = optarg;
+        else if (opt == 'v') sim_verbose = 1;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((trace_path == NULL) == (generate <= 0) || tslice_us < 0 || sim_tick_ns < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    // Slot count must not depend on the host the trace is replayed on
+    if (strcmp(ncpu_str, "auto") == 0) {
+        fprintf(stderr, "NCPU must be a positive integer for the simulator\n");
+        return 1;
+    }
+
+    if (trace_path != NULL && load_trace(trace_path) == -1) return 1;
+    if (generate > 0) generate_trace(generate, interarrival, burst, io_fraction, io_mean);
+    if (trace_out != NULL && write_trace(trace_out) == -1) return 1;
+
+    shared_mem = calloc(1, sizeof(SharedMemory));
+    if (shared_mem == NULL) {
+        perror("calloc failed");
+        return 1;
+    }
+    // Prometheus output would be paced by the host clock, not the simulated one
+    unsetenv("SCHED_PROM_FILE");
+    if (init_scheduler(ncpu_str, tslice_us) == -1) return 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report();
+    // Kept off stdout so reports from the same input compare equal
+    fprintf(stderr, "sched-sim: replayed in %.3f s host\n",
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    free(shared_mem);
+    free(jobs);
+    free(segments);
+    free(deps);
+    return 0;
+}
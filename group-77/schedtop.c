@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "shared_memory.h"
+
+// Live view of the scheduler, built only from the shared segment (attached read-only)
+// and /proc. It never signals or locks anything the scheduler uses.
+
+#define DEFAULT_INTERVAL_MS 250
+#define SHOWN_CHANGES 3
+
+volatile sig_atomic_t stop = 0;
+
+void handle_sigint(int sig) {
+    stop = 1;
+}
+
+// Segment id: -s argument, then $SIMPLE_SHELL_SHMID (set by the shell), then the
+// shell's ftok key for the current directory
+int find_segment(const char *arg) {
+    if (arg != NULL) return atoi(arg);
+    const char *env = getenv("SIMPLE_SHELL_SHMID");
+    if (env != NULL && *env != '\0') return atoi(env);
+
+    key_t key = ftok(".", 's');
+    if (key == -1) {
+        perror("ftok failed");
+        return -1;
+    }
+    int id = shmget(key, 0, 0);
+    if (id == -1) perror("shmget failed (is simple-shell running here?)");
+    return id;
+}
+
+// utime + stime from /proc/<pid>/stat in milliseconds, or -1 once the process is gone
+long long cpu_time_ms(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // The command name may contain spaces, so count fields from the closing paren
+    char *p = strrchr(buf, ')');
+    if (p == NULL) return -1;
+    unsigned long long utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+int slot_of(const SchedStats *st, pid_t pid) {
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        if (st->slot_pid[i] == pid) return i;
+    }
+    return -1;
+}
+
+void draw(const SharedMemory *shm, int clear) {
+    SchedStats st;
+    sched_stats_read(&shm->stats, &st);
+
+    if (clear) printf("\033[H\033[J");
+    char when[32];
+    strftime(when, sizeof(when), "%H:%M:%S", localtime(&st.updated));
+    printf("schedtop - updated %s  ncpu %d/%d  slots busy %d  dispatch rate %.1f/s\n",
+           st.updated ? when : "never", st.ncpu, st.max_ncpu, st.slots_busy, st.dispatch_rate);
+    printf("ticks %llu  dispatches %llu  preemptions %llu  completions %llu  tick avg %.1f us  max %.1f us\n",
+           st.ticks, st.dispatches, st.preemptions, st.completions,
+           st.ticks ? st.tick_ns_total / (double)st.ticks / 1000.0 : 0.0, st.tick_ns_max / 1000.0);
+
+    printf("tslice %d us (%s)  overhead %.2f%%  p99 wait %.2f ms  adjustments %llu\n",
+           st.tslice_us, st.tslice_auto ? "auto" : "fixed", st.overhead_pct, st.wait_p99_us / 1000.0,
+           st.tslice_changes);
+    // Newest autotune adjustments first; their timestamps are on the scheduler's CLOCK_MONOTONIC
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int k = 0; k < SHOWN_CHANGES && (unsigned long long)k < st.tslice_changes; k++) {
+        const SliceChange *c = &st.slice_log[(st.tslice_changes - 1 - k) % SLICE_LOG_SIZE];
+        printf("  %7.1fs ago  %d -> %d us  (overhead %.2f%%, p99 wait %.2f ms)\n",
+               (now.tv_sec - c->at.tv_sec) + (now.tv_nsec - c->at.tv_nsec) / 1e9,
+               c->from_us, c->to_us, c->overhead_pct, c->wait_p99_us / 1000.0);
+    }
+    printf("ready queue:");
+    for (int p = 1; p <= MAX_PRIORITY; p++) {
+        printf("  p%d %d", p, st.queue_depth[p]);
+    }
+    printf("\n\n");
+
+    printf("%-6s %-8s %-20s %-8s %-8s %-10s\n", "SLOT", "PID", "NAME", "PRIO", "SLICES", "CPU (ms)");
+    int slots = st.max_ncpu < STATS_SLOTS ? st.max_ncpu : STATS_SLOTS;
+    for (int i = 0; i < slots; i++) {
+        pid_t pid = st.slot_pid[i];
+        if (pid == 0) {
+            printf("%-6d %-8s %-20s\n", i, "-", i < st.ncpu ? "idle" : "offline");
+            continue;
+        }
+        const SharedJob *job = NULL;
+        for (int k = 0; k < shm->job_count && k < MAX_JOBS; k++) {
+            if (shm->jobs[k].job_pid == pid) job = &shm->jobs[k];
+        }
+        printf("%-6d %-8d %-20.20s %-8d %-8d %-10lld\n", i, pid,
+               job ? job->name : "?", job ? job->priority : 0,
+               job ? job->slices_run : 0, cpu_time_ms(pid));
+    }
+
+    printf("\n%-8s %-20s %-8s %-10s %-8s %-10s\n", "PID", "NAME", "PRIO", "STATE", "SLICES", "CPU (ms)");
+    for (int k = 0; k < shm->job_count && k < MAX_JOBS; k++) {
+        const SharedJob *job = &shm->jobs[k];
+        if (job->completed || job->job_pid == 0) continue;
+        const char *state = job->is_new ? (job->after_count > 0 ? "held" : "new")
+                          : slot_of(&st, job->job_pid) >= 0 ? "running" : "queued";
+        printf("%-8d %-20.20s %-8d %-10s %-8d %-10lld\n", job->job_pid, job->name,
+               job->priority, state, job->slices_run, cpu_time_ms(job->job_pid));
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *segment = NULL;
+    int interval_ms = DEFAULT_INTERVAL_MS;
+    long iterations = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:n:")) != -1) {
+        if (opt == 's') segment = optarg;
+        else if (opt == 'd') interval_ms = atoi(optarg);
+        else if (opt == 'n') iterations = atol(optarg);
+        else {
+            fprintf(stderr, "Usage: %s [-s SHMID] [-d INTERVAL_MS] [-n ITERATIONS]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (interval_ms < 10) interval_ms = 10;
+
+    int id = find_segment(segment);
+    if (id == -1) return 1;
+    const SharedMemory *shm = shmat(id, NULL, SHM_RDONLY);
+    if (shm == (void *)-1) {
+        perror("shmat failed");
+        return 1;
+    }
+
+    signal(SIGINT, handle_sigint);
+    int clear = isatty(STDOUT_FILENO);
+    struct timespec delay = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    for (long i = 0; !stop && (iterations < 0 || i < iterations); i++) {
+        if (i > 0) nanosleep(&delay, NULL);
+        draw(shm, clear);
+        if (!clear && (iterations < 0 || i + 1 < iterations)) printf("\n");
+    }
+
+    shmdt(shm);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include <string.h>
+#include <time.h>
+
+// Layout of the SysV segment shared by simple-shell and simple-scheduler
+
+#define MAX_JOBS 100
+
+#define DEFAULT_PRIORITY 1
+#define MAX_PRIORITY 4
+
+// Scheduler state journal, written by the scheduler and removed by the shell
+#define JOURNAL_PATH ".scheduler-journal"
+
+// CPU slots whose current job is published in SchedStats
+#define STATS_SLOTS 64
+
+// Parents a job can wait on (submit --after, submit-dag)
+#define MAX_JOB_DEPS 8
+
+// Most recent TSLICE autotune adjustments kept in SchedStats
+#define SLICE_LOG_SIZE 8
+
+typedef struct {
+    pid_t job_pid;
+    char name[256];
+    int priority;
+    int is_new;
+    int completed;
+    time_t start_time;
+    time_t end_time;
+    int slices_run;  // updated by the scheduler after every slice
+    int exit_status;  // set by the shell before completed
+    int after_count;
+    pid_t after[MAX_JOB_DEPS];  // held until every one of these has exited with status 0
+    int critical_path;  // longest chain of unfinished jobs starting here, set by the scheduler
+} SharedJob;
+
+// One TSLICE autotune adjustment and the measurements behind it
+typedef struct {
+    struct timespec at;  // scheduler clock (CLOCK_MONOTONIC outside the simulator)
+    int from_us;
+    int to_us;
+    double overhead_pct;
+    long long wait_p99_us;
+} SliceChange;
+
+// Written only by the scheduler; readers use sched_stats_read()
+typedef struct {
+    unsigned int seq;  // odd while an update is in progress
+    int ncpu;
+    int max_ncpu;
+    int slots_busy;
+    int queue_depth[MAX_PRIORITY + 1];
+    unsigned long long ticks;
+    unsigned long long dispatches;
+    unsigned long long preemptions;
+    unsigned long long completions;
+    double dispatch_rate;  // dispatches per second over the last second
+    long long tick_ns;
+    long long tick_ns_max;
+    long long tick_ns_total;
+    time_t updated;
+    pid_t slot_pid[STATS_SLOTS];  // job running on each slot, 0 when idle
+    int tslice_us;
+    int tslice_auto;
+    double overhead_pct;  // scheduler time per slice over the last window
+    long long wait_p99_us;  // ready queue to dispatch, over the last window
+    unsigned long long tslice_changes;
+    SliceChange slice_log[SLICE_LOG_SIZE];  // change n is at n % SLICE_LOG_SIZE
+} SchedStats;
+
+typedef struct {
+    SharedJob jobs[MAX_JOBS];
+    int job_count;
+    int scheduler_ready;
+    int scheduler_exiting;  // set by an idle scheduler that is about to leave
+    SchedStats stats;
+} SharedMemory;
+
+// A slot can be reused once the scheduler is done with it and no unfinished job
+// still names it as a parent
+static inline int shared_slot_free(const SharedMemory *shm, int slot) {
+    const SharedJob *job = &shm->jobs[slot];
+    if (!job->completed || job->is_new) return 0;
+    for (int i = 0; i < shm->job_count; i++) {
+        const SharedJob *other = &shm->jobs[i];
+        if (other->completed) continue;
+        for (int d = 0; d < other->after_count; d++) {
+            if (other->after[d] == job->job_pid) return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef SCHEDULER_EMBEDDED
+// simple-scheduler.c linked into the shell runs as a thread instead of as ./s
+int scheduler_start(const char *ncpu_str, int tslice_us);
+void scheduler_notify();
+void scheduler_stop();
+#endif
+
+#ifdef SCHEDULER_SIM
+// simple-scheduler.c driven by sched-sim.c against a simulated clock
+int init_scheduler(const char *ncpu_str, int tslice_us);
+void schedule_processes();
+int scheduler_idle();
+extern SharedMemory *shared_mem;
+extern int tslice;
+
+// Provided by the simulator in place of signals, kill(pid, 0) and CLOCK_MONOTONIC
+extern int sim_verbose;
+extern long long sim_tick_ns;  // what one scheduler tick is charged, in place of measuring it
+void sim_resume(pid_t pid);
+void sim_pause(pid_t pid);
+void sim_cancel(pid_t pid);
+int sim_alive(pid_t pid);
+void sim_clock(struct timespec *ts);
+#endif
+
+static inline void sched_stats_write_begin(SchedStats *s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void sched_stats_write_end(SchedStats *s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copies a consistent snapshot, retrying while the scheduler is mid-update
+static inline void sched_stats_read(const SchedStats *s, SchedStats *out) {
+    unsigned int start, end;
+    do {
+        start = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (start & 1) continue;
+        memcpy(out, (const void *)s, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+        if (start == end) return;
+    } while (1);
+}
+
+#endif
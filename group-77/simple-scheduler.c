@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,10 +10,57 @@
 #include <time.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#include "dummy_main.h"
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared_memory.h"
+
+#ifdef SCHEDULER_EMBEDDED
+// Linked into the shell (gcc -DSCHEDULER_EMBEDDED simple-shell.c simple-scheduler.c -lpthread):
+// the scheduler is a thread driven by a timerfd and woken through an eventfd, reading
+// the shell's job table directly
+#include <pthread.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
 
 #define MAX_PROCESSES 100
 
+// Crash-safe state journal
+#define JOURNAL_MAGIC 0x4a524e4c
+#define JOURNAL_CAPACITY 16384
+
+enum {
+    JOURNAL_ENQUEUE = 1,
+    JOURNAL_DISPATCH,
+    JOURNAL_PAUSE,
+    JOURNAL_COMPLETE
+};
+
+// PSI thresholds (some avg10, percent) used by the automatic NCPU mode
+#define PSI_CPU_HIGH 40.0
+#define PSI_CPU_LOW 10.0
+#define PSI_MEM_HIGH 10.0
+#define PSI_MEM_LOW 2.0
+#define PSI_INTERVAL_SEC 2
+
+// Prometheus textfile-collector output, enabled by SCHED_PROM_FILE
+#define PROM_INTERVAL_SEC 1
+
+// TSLICE autotune ("auto" TSLICE); the overhead budget comes from SCHED_TSLICE_OVERHEAD
+#define AUTOTUNE_START_US 10000
+#define AUTOTUNE_MIN_US 50
+#define AUTOTUNE_MAX_US 500000
+#define AUTOTUNE_WINDOW_MS 500
+#define AUTOTUNE_MIN_TICKS 16
+#define AUTOTUNE_HOLD_WINDOWS 8
+#define AUTOTUNE_OVERHEAD_PCT 1.0
+#define WAIT_SAMPLES 2048
+
 typedef struct Process {
     pid_t pid;
     char name[256];
@@ -21,6 +69,8 @@ typedef struct Process {
     int priority;
     int is_running;
     int slices_run;
+    int critical_path;  // copied from the shared job each tick while a DAG is queued
+    struct timespec ready_since;  // when it last joined the ready queue
 } Process;
 
 typedef struct {
@@ -31,29 +81,146 @@ typedef struct {
 } ProcessQueue;
 
 typedef struct {
-    pid_t job_pid;
-    char name[256];
+    int op;
+    pid_t pid;
     int priority;
-    int is_new;
-    int completed;
+    int slices_run;
+    int slot;
     time_t start_time;
-    time_t end_time;
-} SharedJob;
+} JournalRecord;
 
 typedef struct {
-    SharedJob jobs[100];
-    int job_count;
-    int scheduler_ready;
-} SharedMemory;
+    unsigned int magic;
+    unsigned int capacity;
+    unsigned int record_count;
+    unsigned int pad;
+    JournalRecord records[];
+} Journal;
 
 // Global variables
 ProcessQueue ready_queue;
 Process *running_processes;
 int ncpu;
+int max_ncpu;
+int auto_ncpu = 0;
+time_t last_psi_check = 0;
 int tslice;
 volatile sig_atomic_t timer_expired = 0;
 volatile sig_atomic_t should_exit = 0;
+#ifdef SCHEDULER_EMBEDDED
+extern SharedMemory *shared_mem;  // the shell's own mapping
+#else
 SharedMemory *shared_mem;
+#endif
+Journal *journal;
+
+// Counters published to shared_mem->stats every tick
+unsigned long long total_ticks = 0;
+unsigned long long total_dispatches = 0;
+unsigned long long total_preemptions = 0;
+unsigned long long total_completions = 0;
+long long tick_ns_max = 0;
+long long tick_ns_total = 0;
+double dispatch_rate = 0;
+struct timespec rate_window_start;
+unsigned long long rate_window_dispatches = 0;
+const char *prom_path = NULL;
+time_t last_prom_write = 0;
+int dag_active = 0;  // some unfinished job has parents
+
+// Per-window measurements, kept whether or not TSLICE is autotuned
+struct timespec window_start;
+long long window_wake_ns = 0;  // embedded wakeups that only filled idle slots
+int window_ticks = 0;
+long long tick_samples[WAIT_SAMPLES];  // tick durations in ns, newest kept
+long long wait_samples[WAIT_SAMPLES];  // ready-to-dispatch waits in ns, newest kept
+int wait_count = 0;
+double overhead_pct = 0;
+long long wait_p99_us = 0;
+int tslice_auto = 0;
+int tslice_changed = 0;  // the slice timer has to be re-armed
+double overhead_budget = AUTOTUNE_OVERHEAD_PCT;
+long long shrink_p99_us = -1;  // p99 wait before the last shrink, -1 if the last window did not shrink
+int shrink_hold = 0;  // windows left before another shrink is tried
+unsigned long long tslice_changes = 0;
+SliceChange slice_log[SLICE_LOG_SIZE];
+
+#ifdef SCHEDULER_SIM
+#define sched_log(...) do { if (sim_verbose) printf(__VA_ARGS__); } while (0)
+#else
+#define sched_log(...) printf(__VA_ARGS__)
+#endif
+
+// Signals, liveness checks and the rate clock go through these, so the simulator
+// (sched-sim.c, -DSCHEDULER_SIM) can stand in for real processes and time
+void resume_job(pid_t pid) {
+#ifdef SCHEDULER_SIM
+    sim_resume(pid);
+#else
+    kill(pid, SIGUSR1);
+#endif
+}
+
+void pause_job(pid_t pid) {
+#ifdef SCHEDULER_SIM
+    sim_pause(pid);
+#else
+    kill(pid, SIGUSR2);
+#endif
+}
+
+void cancel_job(pid_t pid) {
+#ifdef SCHEDULER_SIM
+    sim_cancel(pid);
+#else
+    kill(pid, SIGTERM);
+#endif
+}
+
+int job_gone(pid_t pid) {
+#ifdef SCHEDULER_SIM
+    return !sim_alive(pid);
+#else
+    return kill(pid, 0) == -1 && errno == ESRCH;
+#endif
+}
+
+void sched_clock(struct timespec *ts) {
+#ifdef SCHEDULER_SIM
+    sim_clock(ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#endif
+}
+
+// Nanoseconds on sched_clock() since start
+long long sched_elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    sched_clock(&now);
+    return (now.tv_sec - start->tv_sec) * 1000000000LL + (now.tv_nsec - start->tv_nsec);
+}
+
+// Cost of the tick that began at start. Simulated time stands still during a tick, so the
+// simulator charges a fixed modelled cost instead
+long long tick_cost_ns(const struct timespec *start) {
+#ifdef SCHEDULER_SIM
+    (void)start;
+    return sim_tick_ns;
+#else
+    return sched_elapsed_ns(start);
+#endif
+}
+
+// Wall-clock seconds for timestamps; the simulator hands out simulated seconds instead
+time_t sched_time() {
+#ifdef SCHEDULER_SIM
+    struct timespec ts;
+    sim_clock(&ts);
+    return ts.tv_sec;
+#else
+    return time(NULL);
+#endif
+}
 
 void initQueue() {
     ready_queue.front = 0;
@@ -63,6 +230,7 @@ void initQueue() {
 
 void enqueue(Process p) {
     if (ready_queue.size >= MAX_PROCESSES) return;
+    sched_clock(&p.ready_since);
     ready_queue.rear = (ready_queue.rear + 1) % MAX_PROCESSES;
     ready_queue.processes[ready_queue.rear] = p;
     ready_queue.size++;
@@ -77,6 +245,28 @@ Process dequeue() {
     return p;
 }
 
+// Takes the queued job with the longest critical path, oldest first among equals, so
+// independent jobs (all 1) keep their round-robin order
+Process dequeue_critical() {
+    if (!dag_active || ready_queue.size == 0) return dequeue();
+
+    int best = 0;
+    for (int i = 1; i < ready_queue.size; i++) {
+        int idx = (ready_queue.front + i) % MAX_PROCESSES;
+        int best_idx = (ready_queue.front + best) % MAX_PROCESSES;
+        if (ready_queue.processes[idx].critical_path > ready_queue.processes[best_idx].critical_path) best = i;
+    }
+    Process p = ready_queue.processes[(ready_queue.front + best) % MAX_PROCESSES];
+    // Close the gap by moving the jobs queued ahead of it back one place
+    for (int i = best; i > 0; i--) {
+        ready_queue.processes[(ready_queue.front + i) % MAX_PROCESSES] =
+            ready_queue.processes[(ready_queue.front + i - 1) % MAX_PROCESSES];
+    }
+    ready_queue.front = (ready_queue.front + 1) % MAX_PROCESSES;
+    ready_queue.size--;
+    return p;
+}
+
 void timer_handler(int signo) {
     timer_expired = 1;
 }
@@ -86,9 +276,9 @@ void term_handler(int signo) {
 }
 
 void stop_running_processes() {
-    for (int i = 0; i < ncpu; i++) {
+    for (int i = 0; i < max_ncpu; i++) {
         if (running_processes[i].pid != 0) {
-            kill(running_processes[i].pid, SIGUSR2);
+            pause_job(running_processes[i].pid);
             if (!should_exit) {
                 enqueue(running_processes[i]);
             }
@@ -97,9 +287,183 @@ void stop_running_processes() {
     }
 }
 
-#include <sys/time.h>  // For precise timing with gettimeofday
+
+SharedJob *find_shared_job(pid_t pid) {
+    for (int i = 0; i < shared_mem->job_count; i++) {
+        if (shared_mem->jobs[i].job_pid == pid) {
+            return &shared_mem->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+// A job is finished once the shell has reaped it or the pid no longer exists
+int job_finished(pid_t pid) {
+    SharedJob *job = find_shared_job(pid);
+    if (job != NULL && job->completed) return 1;
+    return job_gone(pid);
+}
+
+size_t journal_size(unsigned int capacity) {
+    return sizeof(Journal) + (size_t)capacity * sizeof(JournalRecord);
+}
+
+Journal *journal_map(const char *path, int create) {
+    int fd = open(path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0600);
+    if (fd == -1) return NULL;
+
+    size_t size = journal_size(JOURNAL_CAPACITY);
+    struct stat st;
+    if (create) {
+        if (ftruncate(fd, size) == -1) {
+            close(fd);
+            return NULL;
+        }
+    } else if (fstat(fd, &st) == -1 || (size_t)st.st_size != size) {
+        close(fd);
+        return NULL;
+    }
+
+    Journal *j = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (j == MAP_FAILED) return NULL;
+
+    if (create) {
+        j->capacity = JOURNAL_CAPACITY;
+        j->record_count = 0;
+        j->magic = JOURNAL_MAGIC;
+    } else if (j->magic != JOURNAL_MAGIC || j->capacity != JOURNAL_CAPACITY) {
+        munmap(j, size);
+        return NULL;
+    }
+    return j;
+}
+
+void journal_checkpoint();
+
+// Appends a record; it becomes visible to recovery once record_count is bumped
+void journal_append(int op, Process *p, int slot) {
+    if (journal == NULL) return;
+    if (journal->record_count >= journal->capacity) {
+        journal_checkpoint();
+        if (journal == NULL) return;
+    }
+
+    JournalRecord *r = &journal->records[journal->record_count];
+    r->op = op;
+    r->pid = p->pid;
+    r->priority = p->priority;
+    r->slices_run = p->slices_run;
+    r->slot = slot;
+    r->start_time = p->start_time;
+    __atomic_store_n(&journal->record_count, journal->record_count + 1, __ATOMIC_RELEASE);
+}
+
+// Compacts the journal into one record per live job, swapped in with rename()
+void journal_checkpoint() {
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", JOURNAL_PATH);
+    Journal *old = journal;
+
+    journal = journal_map(tmp_path, 1);
+    if (journal == NULL) {
+        perror("Journal checkpoint failed");
+        munmap(old, journal_size(JOURNAL_CAPACITY));
+        return;
+    }
+
+    for (int i = 0; i < max_ncpu; i++) {
+        if (running_processes[i].pid != 0) {
+            journal_append(JOURNAL_DISPATCH, &running_processes[i], i);
+        }
+    }
+    for (int i = 0, idx = ready_queue.front; i < ready_queue.size; i++) {
+        journal_append(JOURNAL_ENQUEUE, &ready_queue.processes[idx], -1);
+        idx = (idx + 1) % MAX_PROCESSES;
+    }
+
+    if (rename(tmp_path, JOURNAL_PATH) == -1) {
+        perror("Journal rename failed");
+    }
+    munmap(old, journal_size(JOURNAL_CAPACITY));
+}
+
+// Rebuilds the ready queue from the journal, keeping only jobs that still exist
+void journal_recover() {
+    struct timespec t0;
+    sched_clock(&t0);
+
+    Journal *old = journal_map(JOURNAL_PATH, 0);
+    if (old == NULL) {
+        journal = journal_map(JOURNAL_PATH, 1);
+        return;
+    }
+
+    // Replay into one entry per pid, remembering when each was last queued
+    static Process states[MAX_PROCESSES];
+    static unsigned int order[MAX_PROCESSES];
+    int count = 0;
+    unsigned int n = __atomic_load_n(&old->record_count, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n && i < old->capacity; i++) {
+        JournalRecord *r = &old->records[i];
+        int k;
+        for (k = 0; k < count; k++) {
+            if (states[k].pid == r->pid) break;
+        }
+        if (r->op == JOURNAL_COMPLETE) {
+            if (k < count) {
+                states[k] = states[count - 1];
+                order[k] = order[count - 1];
+                count--;
+            }
+            continue;
+        }
+        if (k == count) {
+            if (count == MAX_PROCESSES) continue;
+            memset(&states[k], 0, sizeof(Process));
+            count++;
+        }
+        states[k].pid = r->pid;
+        states[k].priority = r->priority;
+        states[k].slices_run = r->slices_run;
+        states[k].start_time = r->start_time;
+        order[k] = i;
+    }
+    munmap(old, journal_size(JOURNAL_CAPACITY));
+
+    // Requeue survivors in the order they were last queued or dispatched
+    int recovered = 0;
+    for (;;) {
+        int best = -1;
+        for (int k = 0; k < count; k++) {
+            if (states[k].pid != 0 && (best == -1 || order[k] < order[best])) best = k;
+        }
+        if (best == -1) break;
+
+        Process p = states[best];
+        states[best].pid = 0;
+        if (job_finished(p.pid)) continue;
+
+        SharedJob *job = find_shared_job(p.pid);
+        if (job != NULL) {
+            strncpy(p.name, job->name, sizeof(p.name) - 1);
+        }
+        // A job that was mid-slice when we died keeps running otherwise
+        pause_job(p.pid);
+        enqueue(p);
+        recovered++;
+    }
+
+    journal = journal_map(JOURNAL_PATH, 1);
+    journal_checkpoint();
+
+    double ms = sched_elapsed_ns(&t0) / 1e6;
+    printf("Recovered %d jobs from %u journal records in %.3f ms.\n", recovered, n, ms);
+}
 
 void check_completed_processes() {
+#if !defined(SCHEDULER_EMBEDDED) && !defined(SCHEDULER_SIM)
+    // Inside the shell every child belongs to its reaper thread, and simulated jobs are not children
     int status;
     pid_t pid;
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
@@ -107,52 +471,343 @@ void check_completed_processes() {
         for (int i = 0; i < shared_mem->job_count; i++) {
             if (shared_mem->jobs[i].job_pid == pid) {
                 shared_mem->jobs[i].completed = 1;
-                shared_mem->jobs[i].end_time = time(NULL);
-                printf("Job %s with PID %d completed.\n", shared_mem->jobs[i].name, pid);
+                shared_mem->jobs[i].end_time = sched_time();
+                sched_log("Job %s with PID %d completed.\n", shared_mem->jobs[i].name, pid);
                 break;
             }
         }
         
-        for (int i = 0; i < ncpu; i++) {
+        for (int i = 0; i < max_ncpu; i++) {
             if (running_processes[i].pid == pid) {
                 running_processes[i].pid = 0;
             }
         }
     }
+#endif
+
+    // Jobs are children of the shell, which marks them completed when reaped
+    for (int i = 0; i < max_ncpu; i++) {
+        if (running_processes[i].pid != 0 && job_finished(running_processes[i].pid)) {
+            sched_log("Job %s with PID %d completed.\n", running_processes[i].name, running_processes[i].pid);
+            journal_append(JOURNAL_COMPLETE, &running_processes[i], i);
+            total_completions++;
+            running_processes[i].pid = 0;
+        }
+    }
 }
 
-void schedule_processes() {
-    // Check and update completed processes
-    check_completed_processes();
-    
-    // Pause running processes and log exact timeslices
-    struct timeval start, end;
-    for (int i = 0; i < ncpu; i++) {
-        if (running_processes[i].pid != 0) {
-            // Capture the start time for each TSLICE
-            gettimeofday(&start, NULL);
+// Whole CPUs allowed by the quota set directly on one cgroup directory, 0 for none
+int cgroup_dir_cpus(const char *dir, int v1) {
+    char path[4096];
+    long long quota = -1, period = 0;
+    FILE *f;
+    if (!v1) {
+        // cgroup v2: "<quota|max> <period>"
+        char buf[64];
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        if ((f = fopen(path, "r")) == NULL) return 0;
+        if (fscanf(f, "%63s %lld", buf, &period) == 2 && strcmp(buf, "max") != 0) {
+            quota = atoll(buf);
+        }
+        fclose(f);
+    } else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if ((f = fopen(path, "r")) == NULL) return 0;
+        if (fscanf(f, "%lld", &quota) != 1) quota = -1;
+        fclose(f);
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        if ((f = fopen(path, "r")) != NULL) {
+            if (fscanf(f, "%lld", &period) != 1) period = 0;
+            fclose(f);
+        }
+    }
+    return quota > 0 && period > 0 ? (quota + period - 1) / period : 0;
+}
 
-            // Pause the process after it uses a TSLICE
-            kill(running_processes[i].pid, SIGUSR2);
-            running_processes[i].slices_run++;
+// Whether controller appears in a comma separated list such as "rw,cpu,cpuacct"
+int has_controller(const char *list, const char *controller) {
+    size_t len = strlen(controller);
+    for (const char *p = list; p != NULL; p = strchr(p, ',')) {
+        if (*p == ',') p++;
+        if (strncmp(p, controller, len) == 0 && (p[len] == ',' || p[len] == '\0')) return 1;
+    }
+    return 0;
+}
 
-            // Calculate how long the process actually ran
-            gettimeofday(&end, NULL);
-            long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
-            printf("Paused job %s with PID %d after %d slices; ran for %ld ms.\n",
-                   running_processes[i].name, running_processes[i].pid,
-                   running_processes[i].slices_run, elapsed_ms);
+// Tightest quota on this process's cgroup and every ancestor visible through the
+// cgroup v2 mount (v1 = 0) or the v1 cpu controller mount (v1 = 1); 0 for none
+int cgroup_cpu_limit(int v1) {
+    char line[4096], mount[4096] = "", root[4096] = "", cgroup[4096] = "";
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // "id parent dev root mountpoint opts [optional...] - fstype source superopts"
+        char r[4096], m[4096], type[64], opts[1024];
+        char *sep = strstr(line, " - ");
+        if (sep == NULL || sscanf(line, "%*s %*s %*s %4095s %4095s", r, m) != 2) continue;
+        if (sscanf(sep + 3, "%63s %*s %1023s", type, opts) != 2) continue;
+        if (v1 ? strcmp(type, "cgroup") == 0 && has_controller(opts, "cpu") : strcmp(type, "cgroup2") == 0) {
+            strcpy(root, r);
+            strcpy(mount, m);
+            break;
+        }
+    }
+    fclose(f);
+    if (mount[0] == '\0') return 0;
 
-            if (!should_exit && !shared_mem->jobs[i].completed) {
-                enqueue(running_processes[i]);
-            }
-            running_processes[i].pid = 0;
+    // "0::/path" for v2, "N:controllers:/path" for v1
+    if ((f = fopen("/proc/self/cgroup", "r")) == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *controllers = strchr(line, ':');
+        char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (path == NULL) continue;
+        *path++ = '\0';
+        controllers++;
+        if (v1 ? has_controller(controllers, "cpu") : controllers[0] == '\0') {
+            path[strcspn(path, "\n")] = '\0';
+            strcpy(cgroup, path);
+            break;
         }
     }
-    
-    // Add new jobs to the ready queue
+    fclose(f);
+    if (cgroup[0] != '/') return 0;
+
+    // The mount may expose a subtree (a container without its own cgroup namespace)
+    size_t root_len = strcmp(root, "/") == 0 ? 0 : strlen(root);
+    const char *rel = cgroup;
+    if (root_len > 0) {
+        if (strncmp(cgroup, root, root_len) != 0 || (cgroup[root_len] != '/' && cgroup[root_len] != '\0')) return 0;
+        rel = cgroup + root_len;
+    }
+
+    char dir[8192];
+    snprintf(dir, sizeof(dir), "%s%s", mount, strcmp(rel, "/") == 0 ? "" : rel);
+    size_t mount_len = strlen(mount);
+    int limit = 0;
+    while (1) {
+        int cpus = cgroup_dir_cpus(dir, v1);
+        if (cpus > 0 && (limit == 0 || cpus < limit)) limit = cpus;
+        if (strlen(dir) <= mount_len) break;
+        *strrchr(dir, '/') = '\0';
+    }
+    return limit;
+}
+
+// Number of CPUs this process may run on, further capped by the tightest cgroup CPU
+// quota on the way from its own cgroup up to the root
+int detect_cpu_limit() {
+    int cpus = 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = CPU_COUNT(&set);
+    } else {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > 0) cpus = n;
+    }
+
+    // Hybrid hosts mount both; the cpu controller lives in whichever hierarchy has it
+    for (int v1 = 0; v1 <= 1; v1++) {
+        int quota_cpus = cgroup_cpu_limit(v1);
+        if (quota_cpus > 0 && quota_cpus < cpus) cpus = quota_cpus;
+    }
+    return cpus > 0 ? cpus : 1;
+}
+
+// Reads the "some avg10" value from a /proc/pressure file, -1 if unavailable
+double read_psi_some_avg10(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    double avg10 = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "some avg10=%lf", &avg10) == 1) break;
+    }
+    fclose(f);
+    return avg10;
+}
+
+// Shrinks the slot count when the host is contended and grows it back when idle
+void adjust_ncpu_from_pressure() {
+    time_t now = sched_time();
+    if (now - last_psi_check < PSI_INTERVAL_SEC) return;
+    last_psi_check = now;
+
+    double cpu = read_psi_some_avg10("/proc/pressure/cpu");
+    double mem = read_psi_some_avg10("/proc/pressure/memory");
+    if (cpu < 0 && mem < 0) return;
+
+    int old_ncpu = ncpu;
+    if ((cpu >= 0 && cpu > PSI_CPU_HIGH) || (mem >= 0 && mem > PSI_MEM_HIGH)) {
+        if (ncpu > 1) ncpu--;
+    } else if ((cpu < 0 || cpu < PSI_CPU_LOW) && (mem < 0 || mem < PSI_MEM_LOW)) {
+        if (ncpu < max_ncpu) ncpu++;
+    }
+
+    if (ncpu != old_ncpu) {
+        sched_log("NCPU auto: cpu some avg10=%.2f memory some avg10=%.2f, %s slots %d -> %d (max %d).\n",
+               cpu, mem, ncpu < old_ncpu ? "shrinking" : "growing", old_ncpu, ncpu, max_ncpu);
+    }
+}
+
+// Writes the stats page in the textfile-collector format; rename() keeps scrapes atomic
+void write_prometheus_file(SchedStats *st) {
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", prom_path);
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        perror("Cannot write Prometheus textfile");
+        prom_path = NULL;
+        return;
+    }
+
+    fprintf(f, "# HELP simple_scheduler_queue_depth Jobs waiting in the ready queue.\n");
+    fprintf(f, "# TYPE simple_scheduler_queue_depth gauge\n");
+    for (int p = 1; p <= MAX_PRIORITY; p++) {
+        fprintf(f, "simple_scheduler_queue_depth{priority=\"%d\"} %d\n", p, st->queue_depth[p]);
+    }
+    fprintf(f, "# HELP simple_scheduler_slots Scheduling slots currently active.\n");
+    fprintf(f, "# TYPE simple_scheduler_slots gauge\n");
+    fprintf(f, "simple_scheduler_slots %d\n", st->ncpu);
+    fprintf(f, "# HELP simple_scheduler_slots_busy Slots running a job.\n");
+    fprintf(f, "# TYPE simple_scheduler_slots_busy gauge\n");
+    fprintf(f, "simple_scheduler_slots_busy %d\n", st->slots_busy);
+    fprintf(f, "# HELP simple_scheduler_slot_utilisation Fraction of active slots running a job.\n");
+    fprintf(f, "# TYPE simple_scheduler_slot_utilisation gauge\n");
+    fprintf(f, "simple_scheduler_slot_utilisation %.4f\n", st->ncpu > 0 ? (double)st->slots_busy / st->ncpu : 0);
+    fprintf(f, "# HELP simple_scheduler_dispatches_total Jobs resumed with SIGUSR1.\n");
+    fprintf(f, "# TYPE simple_scheduler_dispatches_total counter\n");
+    fprintf(f, "simple_scheduler_dispatches_total %llu\n", st->dispatches);
+    fprintf(f, "# HELP simple_scheduler_dispatch_rate Dispatches per second over the last second.\n");
+    fprintf(f, "# TYPE simple_scheduler_dispatch_rate gauge\n");
+    fprintf(f, "simple_scheduler_dispatch_rate %.2f\n", st->dispatch_rate);
+    fprintf(f, "# HELP simple_scheduler_preemptions_total Jobs paused with SIGUSR2 and requeued.\n");
+    fprintf(f, "# TYPE simple_scheduler_preemptions_total counter\n");
+    fprintf(f, "simple_scheduler_preemptions_total %llu\n", st->preemptions);
+    fprintf(f, "# HELP simple_scheduler_completions_total Jobs seen to finish.\n");
+    fprintf(f, "# TYPE simple_scheduler_completions_total counter\n");
+    fprintf(f, "simple_scheduler_completions_total %llu\n", st->completions);
+    fprintf(f, "# HELP simple_scheduler_ticks_total Scheduling ticks run.\n");
+    fprintf(f, "# TYPE simple_scheduler_ticks_total counter\n");
+    fprintf(f, "simple_scheduler_ticks_total %llu\n", st->ticks);
+    fprintf(f, "# HELP simple_scheduler_tick_duration_seconds Duration of the last scheduling tick.\n");
+    fprintf(f, "# TYPE simple_scheduler_tick_duration_seconds gauge\n");
+    fprintf(f, "simple_scheduler_tick_duration_seconds %.9f\n", st->tick_ns / 1e9);
+    fprintf(f, "# HELP simple_scheduler_tick_duration_max_seconds Longest scheduling tick so far.\n");
+    fprintf(f, "# TYPE simple_scheduler_tick_duration_max_seconds gauge\n");
+    fprintf(f, "simple_scheduler_tick_duration_max_seconds %.9f\n", st->tick_ns_max / 1e9);
+    fprintf(f, "# HELP simple_scheduler_tick_seconds_total Time spent in scheduling ticks.\n");
+    fprintf(f, "# TYPE simple_scheduler_tick_seconds_total counter\n");
+    fprintf(f, "simple_scheduler_tick_seconds_total %.9f\n", st->tick_ns_total / 1e9);
+    fprintf(f, "# HELP simple_scheduler_tslice_seconds Current time slice.\n");
+    fprintf(f, "# TYPE simple_scheduler_tslice_seconds gauge\n");
+    fprintf(f, "simple_scheduler_tslice_seconds %.6f\n", st->tslice_us / 1e6);
+    fprintf(f, "# HELP simple_scheduler_overhead_ratio Scheduling time per slice over the last window.\n");
+    fprintf(f, "# TYPE simple_scheduler_overhead_ratio gauge\n");
+    fprintf(f, "simple_scheduler_overhead_ratio %.6f\n", st->overhead_pct / 100);
+    fprintf(f, "# HELP simple_scheduler_wait_p99_seconds 99th percentile wait from ready queue to dispatch over the last window.\n");
+    fprintf(f, "# TYPE simple_scheduler_wait_p99_seconds gauge\n");
+    fprintf(f, "simple_scheduler_wait_p99_seconds %.6f\n", st->wait_p99_us / 1e6);
+    fprintf(f, "# HELP simple_scheduler_tslice_changes_total Time slice adjustments made by autotune.\n");
+    fprintf(f, "# TYPE simple_scheduler_tslice_changes_total counter\n");
+    fprintf(f, "simple_scheduler_tslice_changes_total %llu\n", st->tslice_changes);
+    fclose(f);
+
+    if (rename(tmp_path, prom_path) == -1) {
+        perror("Cannot publish Prometheus textfile");
+    }
+}
+
+// Publishes the counters to the seqlock-protected stats page in shared memory
+void publish_stats(long long tick_ns) {
+    struct timespec now;
+    sched_clock(&now);
+
+    total_ticks++;
+    tick_ns_total += tick_ns;
+    if (tick_ns > tick_ns_max) tick_ns_max = tick_ns;
+
+    double window = (now.tv_sec - rate_window_start.tv_sec) + (now.tv_nsec - rate_window_start.tv_nsec) / 1e9;
+    if (window >= 1.0) {
+        dispatch_rate = (total_dispatches - rate_window_dispatches) / window;
+        rate_window_dispatches = total_dispatches;
+        rate_window_start = now;
+    }
+
+    int depth[MAX_PRIORITY + 1] = {0};
+    for (int i = 0, idx = ready_queue.front; i < ready_queue.size; i++) {
+        int p = ready_queue.processes[idx].priority;
+        if (p >= 1 && p <= MAX_PRIORITY) depth[p]++;
+        idx = (idx + 1) % MAX_PROCESSES;
+    }
+    int busy = 0;
+    for (int i = 0; i < max_ncpu; i++) {
+        if (running_processes[i].pid != 0) busy++;
+    }
+
+    SchedStats *st = &shared_mem->stats;
+    sched_stats_write_begin(st);
+    st->ncpu = ncpu;
+    st->max_ncpu = max_ncpu;
+    st->slots_busy = busy;
+    memcpy(st->queue_depth, depth, sizeof(depth));
+    st->ticks = total_ticks;
+    st->dispatches = total_dispatches;
+    st->preemptions = total_preemptions;
+    st->completions = total_completions;
+    st->dispatch_rate = dispatch_rate;
+    st->tick_ns = tick_ns;
+    st->tick_ns_max = tick_ns_max;
+    st->tick_ns_total = tick_ns_total;
+    st->updated = sched_time();
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        st->slot_pid[i] = i < max_ncpu ? running_processes[i].pid : 0;
+    }
+    st->tslice_us = tslice;
+    st->tslice_auto = tslice_auto;
+    st->overhead_pct = overhead_pct;
+    st->wait_p99_us = wait_p99_us;
+    st->tslice_changes = tslice_changes;
+    memcpy(st->slice_log, slice_log, sizeof(slice_log));
+    sched_stats_write_end(st);
+
+    if (prom_path != NULL && st->updated - last_prom_write >= PROM_INTERVAL_SEC) {
+        last_prom_write = st->updated;
+        SchedStats snapshot;
+        sched_stats_read(st, &snapshot);
+        write_prometheus_file(&snapshot);
+    }
+}
+
+// 1 once every parent has exited with status 0, 0 while one is still unfinished,
+// -1 if one failed
+int dependencies_met(SharedJob *job) {
+    int met = 1;
+    for (int d = 0; d < job->after_count; d++) {
+        SharedJob *parent = find_shared_job(job->after[d]);
+        // The shell keeps a parent's slot until its dependents finish
+        if (parent == NULL) return -1;
+        if (!parent->completed) met = 0;
+        else if (parent->exit_status != 0) return -1;
+    }
+    return met;
+}
+
+// Moves jobs the shell has just submitted into the ready queue; jobs with unfinished
+// parents stay new until the parents exit
+void admit_new_jobs() {
     for (int i = 0; i < shared_mem->job_count; i++) {
-        if (shared_mem->jobs[i].is_new && !shared_mem->jobs[i].completed) {
+        if (__atomic_load_n(&shared_mem->jobs[i].is_new, __ATOMIC_ACQUIRE) && !shared_mem->jobs[i].completed) {
+            int ready = dependencies_met(&shared_mem->jobs[i]);
+            if (ready == 0) continue;
+            if (ready == -1) {
+                sched_log("Cancelled job %s with PID %d: a job it runs after failed.\n",
+                       shared_mem->jobs[i].name, shared_mem->jobs[i].job_pid);
+                cancel_job(shared_mem->jobs[i].job_pid);
+                shared_mem->jobs[i].is_new = 0;
+                continue;
+            }
             Process new_process = {
                 .pid = shared_mem->jobs[i].job_pid,
                 .start_time = shared_mem->jobs[i].start_time,
@@ -161,33 +816,409 @@ void schedule_processes() {
             };
             strncpy(new_process.name, shared_mem->jobs[i].name, sizeof(new_process.name) - 1);
             enqueue(new_process);
+            journal_append(JOURNAL_ENQUEUE, &new_process, -1);
             shared_mem->jobs[i].is_new = 0;
-            printf("Added new job %s with PID %d to the queue.\n", new_process.name, new_process.pid);
+            sched_log("Added new job %s with PID %d to the queue.\n", new_process.name, new_process.pid);
         }
     }
-    
-    // Schedule processes based on round-robin order
+}
+
+void record_wait(Process *p) {
+    struct timespec now;
+    sched_clock(&now);
+    wait_samples[wait_count++ % WAIT_SAMPLES] =
+        (now.tv_sec - p->ready_since.tv_sec) * 1000000000LL + (now.tv_nsec - p->ready_since.tv_nsec);
+}
+
+// Scores every unfinished job by the longest chain of unfinished jobs that starts at
+// it, counting itself, and copies the score onto queued entries
+void update_critical_paths() {
+    static int parent_slot[MAX_JOBS][MAX_JOB_DEPS];
+    int n = shared_mem->job_count;
+    dag_active = 0;
+    for (int i = 0; i < n; i++) {
+        SharedJob *job = &shared_mem->jobs[i];
+        job->critical_path = job->completed ? 0 : 1;
+        if (job->completed) continue;
+        for (int d = 0; d < job->after_count; d++) {
+            SharedJob *parent = find_shared_job(job->after[d]);
+            parent_slot[i][d] = parent != NULL && !parent->completed ? parent - shared_mem->jobs : -1;
+            if (parent_slot[i][d] != -1) dag_active = 1;
+        }
+    }
+    if (!dag_active) return;
+
+    // Push scores up the parent links; no chain is longer than the table
+    for (int pass = 0; pass < n; pass++) {
+        int changed = 0;
+        for (int i = 0; i < n; i++) {
+            SharedJob *job = &shared_mem->jobs[i];
+            if (job->completed) continue;
+            for (int d = 0; d < job->after_count; d++) {
+                int p = parent_slot[i][d];
+                if (p != -1 && shared_mem->jobs[p].critical_path < job->critical_path + 1) {
+                    shared_mem->jobs[p].critical_path = job->critical_path + 1;
+                    changed = 1;
+                }
+            }
+        }
+        if (!changed) break;
+    }
+
+    for (int i = 0, idx = ready_queue.front; i < ready_queue.size; i++) {
+        SharedJob *job = find_shared_job(ready_queue.processes[idx].pid);
+        ready_queue.processes[idx].critical_path = job != NULL ? job->critical_path : 0;
+        idx = (idx + 1) % MAX_PROCESSES;
+    }
+}
+
+// Fills idle slots from the ready queue: round-robin, except that jobs on the longest
+// remaining chain of a DAG go first
+void dispatch_ready() {
+    update_critical_paths();
     for (int i = 0; i < ncpu && ready_queue.size > 0; i++) {
         if (running_processes[i].pid == 0) {
-            Process selected = dequeue();
-            
+            Process selected = dequeue_critical();
+            if (selected.pid != 0 && job_finished(selected.pid)) {
+                journal_append(JOURNAL_COMPLETE, &selected, -1);
+                total_completions++;
+                i--;
+                continue;
+            }
+
             running_processes[i] = selected;
             if (running_processes[i].pid != 0) {
-                printf("Starting job %s with PID %d at slice %d.\n",
+                journal_append(JOURNAL_DISPATCH, &running_processes[i], i);
+                total_dispatches++;
+                record_wait(&running_processes[i]);
+                sched_log("Starting job %s with PID %d at slice %d.\n",
                        running_processes[i].name, running_processes[i].pid,
                        running_processes[i].slices_run);
-                kill(running_processes[i].pid, SIGUSR1);
+                resume_job(running_processes[i].pid);
             }
         }
     }
 }
 
+int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Closes a measurement window every AUTOTUNE_WINDOW_MS. With an "auto" TSLICE, shrinks the
+// slice while jobs wait half a slice or more for a slot, down to where the tick would use
+// 90% of the overhead budget; grows it when over budget, and undoes a shrink that raised
+// the p99 wait
+void tune_tslice(long long tick_ns) {
+    tick_samples[window_ticks++ % WAIT_SAMPLES] = tick_ns;
+    struct timespec now;
+    sched_clock(&now);
+    double elapsed_ms = (now.tv_sec - window_start.tv_sec) * 1000.0 + (now.tv_nsec - window_start.tv_nsec) / 1e6;
+    if (elapsed_ms < AUTOTUNE_WINDOW_MS || window_ticks < AUTOTUNE_MIN_TICKS) return;
+
+    // The median tick, so one that lost its CPU to another process is not taken for
+    // scheduling cost
+    int samples = window_ticks < WAIT_SAMPLES ? window_ticks : WAIT_SAMPLES;
+    qsort(tick_samples, samples, sizeof(long long), compare_ns);
+    double window_ns = (double)tick_samples[samples / 2] * window_ticks + window_wake_ns;
+    overhead_pct = 100.0 * window_ns / (window_ticks * (double)tslice * 1000.0);
+    samples = wait_count < WAIT_SAMPLES ? wait_count : WAIT_SAMPLES;
+    wait_p99_us = 0;
+    if (samples > 0) {
+        qsort(wait_samples, samples, sizeof(long long), compare_ns);
+        wait_p99_us = wait_samples[(samples - 1) * 99 / 100] / 1000;
+    }
+    int dispatches = wait_count;
+    window_start = now;
+    window_wake_ns = 0;
+    window_ticks = 0;
+    wait_count = 0;
+    if (!tslice_auto) return;
+
+    long long before_shrink = shrink_p99_us;
+    shrink_p99_us = -1;
+    if (shrink_hold > 0) shrink_hold--;
+
+    // Slice at which this window's scheduling time would be 90% of the budget
+    double floor_us = tslice * overhead_pct / (overhead_budget * 0.9);
+    int next = tslice;
+    const char *reason = NULL;
+    if (overhead_pct > overhead_budget) {
+        next = floor_us > tslice * 2.0 ? tslice * 2 : (int)floor_us + 1;
+        reason = "over the overhead budget";
+    } else if (before_shrink >= 0 && wait_p99_us > before_shrink * 11 / 10) {
+        next = tslice * 5 / 4;
+        reason = "p99 wait rose after the last shrink";
+        shrink_hold = AUTOTUNE_HOLD_WINDOWS;
+    } else if (shrink_hold == 0 && wait_p99_us * 2 >= tslice) {
+        // Far behind: halve rather than creep down
+        next = wait_p99_us >= 4LL * tslice ? tslice / 2 : tslice * 4 / 5;
+        if (next < floor_us) next = floor_us;
+        if (next < tslice) reason = "jobs waiting for a slot";
+    }
+    if (next < AUTOTUNE_MIN_US) next = AUTOTUNE_MIN_US;
+    if (next > AUTOTUNE_MAX_US) next = AUTOTUNE_MAX_US;
+    if (reason == NULL || next == tslice) return;
+
+    sched_log("TSLICE auto: overhead %.2f%% (budget %.2f%%), p99 wait %lld us over %d dispatches, %s: slice %d -> %d us.\n",
+           overhead_pct, overhead_budget, wait_p99_us, dispatches, reason, tslice, next);
+    if (next < tslice) shrink_p99_us = wait_p99_us;
+    SliceChange *change = &slice_log[tslice_changes % SLICE_LOG_SIZE];
+    change->at = now;
+    change->from_us = tslice;
+    change->to_us = next;
+    change->overhead_pct = overhead_pct;
+    change->wait_p99_us = wait_p99_us;
+    tslice_changes++;
+    tslice = next;
+    tslice_changed = 1;
+}
+
+// A relaunched scheduler carries on from the slice and log the previous one published
+void resume_autotune() {
+    SchedStats st;
+    sched_stats_read(&shared_mem->stats, &st);
+    if (!st.tslice_auto || st.tslice_us <= 0) return;
+    tslice = st.tslice_us;
+    tslice_changes = st.tslice_changes;
+    memcpy(slice_log, st.slice_log, sizeof(slice_log));
+}
+
+void schedule_processes() {
+    struct timespec tick_start;
+    sched_clock(&tick_start);
+
+    // Check and update completed processes
+    check_completed_processes();
+
+    if (auto_ncpu) {
+        adjust_ncpu_from_pressure();
+    }
+    
+    // Pause running processes and log exact timeslices
+    struct timespec start;
+    for (int i = 0; i < max_ncpu; i++) {
+        if (running_processes[i].pid != 0) {
+            // Capture the start time for each TSLICE
+            sched_clock(&start);
 
+            // Pause the process after it uses a TSLICE
+            pause_job(running_processes[i].pid);
+            running_processes[i].slices_run++;
+            SharedJob *shared = find_shared_job(running_processes[i].pid);
+            if (shared != NULL) shared->slices_run = running_processes[i].slices_run;
+
+            // Calculate how long the process actually ran
+            long elapsed_ms = sched_elapsed_ns(&start) / 1000000;
+            sched_log("Paused job %s with PID %d after %d slices; ran for %ld ms.\n",
+                   running_processes[i].name, running_processes[i].pid,
+                   running_processes[i].slices_run, elapsed_ms);
 
+            if (!should_exit && !job_finished(running_processes[i].pid)) {
+                enqueue(running_processes[i]);
+                journal_append(JOURNAL_PAUSE, &running_processes[i], -1);
+                total_preemptions++;
+            } else if (!should_exit) {
+                journal_append(JOURNAL_COMPLETE, &running_processes[i], i);
+                total_completions++;
+            }
+            running_processes[i].pid = 0;
+        }
+    }
+    
+    admit_new_jobs();
+    dispatch_ready();
+
+    long long tick_ns = tick_cost_ns(&tick_start);
+    tune_tslice(tick_ns);
+    publish_stats(tick_ns);
+}
+
+
+
+
+
+// Slot count and slice length (0 for an autotuned slice); shared by the standalone and
+// embedded schedulers
+int init_scheduler(const char *ncpu_str, int tslice_us) {
+    if (strcmp(ncpu_str, "auto") == 0) {
+        auto_ncpu = 1;
+        max_ncpu = detect_cpu_limit();
+        ncpu = max_ncpu;
+        printf("NCPU auto: starting with %d slots from CPU affinity and cgroup quota.\n", ncpu);
+    } else {
+        ncpu = atoi(ncpu_str);
+        max_ncpu = ncpu;
+    }
+    if (ncpu < 1) {
+        fprintf(stderr, "NCPU must be a positive integer or 'auto'\n");
+        return -1;
+    }
+    if (tslice_us <= 0) {
+        tslice_auto = 1;
+        tslice_us = AUTOTUNE_START_US;
+        const char *budget = getenv("SCHED_TSLICE_OVERHEAD");
+        if (budget != NULL && atof(budget) > 0) overhead_budget = atof(budget);
+        printf("TSLICE auto: starting at %d us with a %.2f%% overhead budget.\n", tslice_us, overhead_budget);
+    }
+    tslice = tslice_us;
+
+    initQueue();
+    prom_path = getenv("SCHED_PROM_FILE");
+    sched_clock(&rate_window_start);
+    window_start = rate_window_start;
+    running_processes = calloc(max_ncpu, sizeof(Process));
+    return 0;
+}
+
+int scheduler_idle() {
+    if (ready_queue.size > 0) return 0;
+    for (int i = 0; i < max_ncpu; i++) {
+        if (running_processes[i].pid != 0) return 0;
+    }
+    return 1;
+}
+
+#ifdef SCHEDULER_EMBEDDED
+
+int timer_fd = -1;
+int wake_fd = -1;
+int timer_armed = 0;
+pthread_t scheduler_thread;
+int scheduler_started = 0;
+
+// The slice clock only runs while there is something to schedule
+void arm_timer(int on) {
+    if (on == timer_armed) return;
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (on) {
+        its.it_value.tv_sec = tslice / 1000000;
+        its.it_value.tv_nsec = (tslice % 1000000) * 1000L;
+        its.it_interval = its.it_value;
+    }
+    timerfd_settime(timer_fd, 0, &its, NULL);
+    timer_armed = on;
+}
+
+// A wakeup only fills idle slots; running jobs keep the rest of their slice
+void fill_idle_slots() {
+    struct timespec start;
+    sched_clock(&start);
+    check_completed_processes();
+    admit_new_jobs();
+    dispatch_ready();
+    long long ns = sched_elapsed_ns(&start);
+    window_wake_ns += ns;  // counts towards overhead, but it is not a slice
+    publish_stats(ns);
+}
+
+void *scheduler_loop(void *arg) {
+    // Off the shell's core by default, or on SIMPLE_SHELL_SCHED_CPU when set
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int cpu = -1;
+        const char *env = getenv("SIMPLE_SHELL_SCHED_CPU");
+        if (env != NULL) {
+            cpu = atoi(env);
+        } else {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &set)) cpu = i;
+            }
+        }
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) fprintf(stderr, "Scheduler: cannot pin to CPU %d: %s\n", cpu, strerror(err));
+    }
+
+    struct pollfd fds[2] = { { timer_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+    while (!should_exit) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Scheduler poll failed");
+            break;
+        }
+        uint64_t count;
+        if (fds[1].revents & POLLIN) {
+            read(wake_fd, &count, sizeof(count));
+            if (!should_exit) fill_idle_slots();
+        }
+        if (fds[0].revents & POLLIN) {
+            read(timer_fd, &count, sizeof(count));
+            if (!should_exit) schedule_processes();
+        }
+        fflush(stdout);
+        if (tslice_changed) {
+            tslice_changed = 0;
+            arm_timer(0);
+        }
+        arm_timer(!scheduler_idle());
+    }
+
+    stop_running_processes();
+    fflush(stdout);
+    return NULL;
+}
+
+// Starts the scheduler thread once; later calls do nothing
+int scheduler_start(const char *ncpu_str, int tslice_us) {
+    if (scheduler_started) return 0;
+    if (init_scheduler(ncpu_str, tslice_us) == -1) return -1;
+    // The shell's children die with it, so there is nothing for a journal to recover
+    journal = NULL;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (timer_fd == -1 || wake_fd == -1) {
+        perror("Scheduler timerfd/eventfd");
+        return -1;
+    }
+
+    // Signals stay with the shell's main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old_mask);
+    int err = pthread_create(&scheduler_thread, NULL, scheduler_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Scheduler thread: %s\n", strerror(err));
+        return -1;
+    }
+    scheduler_started = 1;
+    return 0;
+}
+
+// Called after a submit or a reaped job; safe from any thread
+void scheduler_notify() {
+    uint64_t one = 1;
+    if (wake_fd != -1) write(wake_fd, &one, sizeof(one));
+}
+
+// Pauses whatever is running and waits for the thread to finish
+void scheduler_stop() {
+    if (!scheduler_started) return;
+    scheduler_started = 0;
+    should_exit = 1;
+    scheduler_notify();
+    pthread_join(scheduler_thread, NULL);
+}
+
+#elif !defined(SCHEDULER_SIM)
+
+// Also re-armed whenever autotune changes the slice
+int arm_slice_timer() {
+    struct itimerval timer;
+    timer.it_value.tv_sec = tslice / 1000000;
+    timer.it_value.tv_usec = tslice % 1000000;
+    timer.it_interval = timer.it_value;
+    return setitimer(ITIMER_REAL, &timer, NULL);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <NCPU> <TSLICE> <SHMID>\n", argv[0]);
+    if (argc != 4 && !(argc == 5 && strcmp(argv[4], "recover") == 0)) {
+        fprintf(stderr, "Usage: %s <NCPU|auto> <TSLICE|auto> <SHMID> [recover]\n", argv[0]);
         return 1;
     }
     
@@ -201,8 +1232,14 @@ int main(int argc, char *argv[]) {
     sa.sa_handler = term_handler;
     sigaction(SIGTERM, &sa, NULL);
     
-    ncpu = atoi(argv[1]);
-    tslice = atoi(argv[2]);
+    int tslice_us = strcmp(argv[2], "auto") == 0 ? 0 : atoi(argv[2]);
+    if (tslice_us <= 0 && strcmp(argv[2], "auto") != 0) {
+        fprintf(stderr, "TSLICE must be a positive number of microseconds or 'auto'\n");
+        return 1;
+    }
+    if (init_scheduler(argv[1], tslice_us) == -1) {
+        return 1;
+    }
     int shmid = atoi(argv[3]);
     
     // Attach to shared memory
@@ -211,18 +1248,20 @@ int main(int argc, char *argv[]) {
         perror("shmat failed");
         exit(1);
     }
+
+    if (argc == 5) {
+        journal_recover();
+    } else {
+        journal = journal_map(JOURNAL_PATH, 1);
+    }
+    if (journal == NULL) {
+        perror("Journal unavailable, continuing without crash recovery");
+    }
     
-    // Initialize
-    initQueue();
-    running_processes = calloc(ncpu, sizeof(Process));
-    
+    if (tslice_auto) resume_autotune();
+
     // Set up timer
-    struct itimerval timer;
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = tslice;
-    timer.it_interval = timer.it_value;
-    
-    if (setitimer(ITIMER_REAL, &timer, NULL) < 0) {
+    if (arm_slice_timer() < 0) {
         perror("setitimer failed");
         exit(1);
     }
@@ -232,6 +1271,10 @@ int main(int argc, char *argv[]) {
         if (timer_expired) {
             schedule_processes();
             timer_expired = 0;
+            if (tslice_changed) {
+                tslice_changed = 0;
+                arm_slice_timer();
+            }
             
             // Check if all processes are completed
             int active_processes = 0;
@@ -241,16 +1284,16 @@ int main(int argc, char *argv[]) {
                 }
             }
             
-            if (active_processes == 0 && ready_queue.size == 0) {
-                // Double check no processes are running
-                int running = 0;
-                for (int i = 0; i < ncpu; i++) {
-                    if (running_processes[i].pid != 0) {
-                        running = 1;
-                        break;
-                    }
+            if (active_processes == 0 && scheduler_idle()) {
+                // Announce the exit, then look once more: a job submitted in between is
+                // either seen here or the shell sees the flag and relaunches us
+                __atomic_store_n(&shared_mem->scheduler_exiting, 1, __ATOMIC_SEQ_CST);
+                int pending = 0;
+                for (int i = 0; i < shared_mem->job_count; i++) {
+                    if (__atomic_load_n(&shared_mem->jobs[i].is_new, __ATOMIC_SEQ_CST)) pending = 1;
                 }
-                if (!running) break;
+                if (!pending) break;
+                __atomic_store_n(&shared_mem->scheduler_exiting, 0, __ATOMIC_SEQ_CST);
             }
         }
         usleep(100);
@@ -259,7 +1302,12 @@ int main(int argc, char *argv[]) {
     // Cleanup
     stop_running_processes();
     free(running_processes);
+    if (journal != NULL) {
+        munmap(journal, journal_size(JOURNAL_CAPACITY));
+    }
     shmdt(shared_mem);
     
     return 0;
 }
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,38 +14,62 @@
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <spawn.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <malloc.h>
+#include "shared_memory.h"
 
 #define INPUT_MAX 1024
+#define DEFAULT_TSLICE 100
+// -f scripts are read this much at a time
+#define BATCH_CHUNK (64 * 1024)
 #define ARGS_MAX 100
-#define HISTORY_MAX 100
+// parallel lets finished jobs queue up this many times -j behind the oldest one
+#define PARALLEL_WINDOW 4
+
+// Job output is tagged and forwarded a line at a time by one epoll thread
+#define OUTPUT_LINE_MAX 4096
+#define OUTPUT_EVENTS_MAX 64
+#define OUTPUT_SPLICE_CHUNK (1 << 20)
+
+// cat and cp hand the kernel this much per call, checking for Ctrl-C in between
+#define COPY_CHUNK (64 << 20)
+
+// Per-line temporaries come from arena chunks of this size; one is kept between lines
+#define ARENA_CHUNK (64 * 1024)
+
+// Captured output keeps this much per job in memory; older bytes spill to a file
+#define CAPTURE_RING_DEFAULT (64 * 1024)
+
+enum {
+    OUTPUT_TAGGED,   // line-tagged copy to the terminal
+    OUTPUT_SPLICE,   // raw bytes moved with splice/tee, never copied to user space
+    OUTPUT_CAPTURE   // kept in a per-job ring, read back with the output builtin
+};
+
+// Per-job cgroup v2 leaves live under this directory unless SIMPLE_SHELL_CGROUP is set
+#define CGROUP_FS "/sys/fs/cgroup"
 
-#define DEFAULT_PRIORITY 1
-#define MAX_PRIORITY 4
 
 typedef struct {
-    char *command;
+    const char *command;      // interned
     pid_t pid;
     time_t start_time;
     time_t end_time;
     int is_background;
+    struct timespec start_mono;
+    struct timespec end_mono;
+    struct rusage usage;      // summed over every process of the command, from wait4
 } CommandLog;
 
-typedef struct {
-    pid_t job_pid;
-    char name[256];
-    int priority;
-    int is_new;
-    int completed;
-    time_t start_time;
-    time_t end_time;
-} SharedJob;
-
-typedef struct {
-    SharedJob jobs[HISTORY_MAX];
-    int job_count;
-    int scheduler_ready;
-} SharedMemory;
-
 
 key_t key;
 int shmid;
@@ -59,34 +84,580 @@ typedef struct {
     int completed;
     int slices_run;
     int priority;  
+    char cgroup[512];
+    struct JobCapture *capture;
+    int quiet;        // submitted by parallel: no per-job messages
+    int exit_status;
+    int dag;          // 0 unless submitted with --after, by submit-dag, or waited on
+    int depth;        // jobs on the longest chain of parents ending here, itself included
+    struct timespec start_mono;
+    struct timespec end_mono;
+    struct rusage usage;
 } SchedulerJob;
 
-CommandLog command_history[HISTORY_MAX];
-SchedulerJob scheduler_jobs[HISTORY_MAX];
+// Logical bytes [spilled, head) live in the ring at offset % ring_size; [0, spilled) in the spill file
+typedef struct JobCapture {
+    pid_t pid;
+    char *ring;
+    size_t ring_size;
+    size_t head;
+    size_t spilled;
+    int spill_fd;
+    char spill_path[256];
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} JobCapture;
+
+typedef struct {
+    char cpu_max[64];
+    char memory_max[64];
+    char io_max[128];
+    int per_class;
+    char out_path[256];
+    char tee_path[256];
+    int raw;
+    int capture;
+    int pipe_size;
+    int quiet;
+    pid_t after[MAX_JOB_DEPS];  // run only once these jobs have exited 0
+    int after_count;
+    int dag;  // submit-dag's DAG; 0 makes --after join its first parent's
+} SubmitOptions;
+
+typedef struct {
+    int fd;
+    pid_t pid;
+    int mode;
+    int dest_fd;
+    int tee_fd;
+    int tee_pipe[2];
+    int copy_fallback;
+    JobCapture *capture;
+    int tag_len;
+    char tag[80];
+    size_t partial_len;
+    char partial[OUTPUT_LINE_MAX];
+} OutputStream;
+
+int output_epoll_fd = -1;
+
+// Command-line AST; all nodes live in a fixed per-line pool (see parseCommandLine)
+enum {
+    REDIR_IN,      // <
+    REDIR_OUT,     // >
+    REDIR_APPEND   // >>
+};
+
+enum {
+    CONNECT_END,   // last entry on the line
+    CONNECT_SEQ,   // ;
+    CONNECT_AND,   // &&
+    CONNECT_OR     // ||
+};
+
+typedef struct {
+    int type;
+    int fd;
+    char *target;
+} Redirect;
+
+typedef struct {
+    char **argv;
+    int argc;
+    Redirect *redirs;
+    int redir_count;
+} SimpleCommand;
+
+typedef struct {
+    SimpleCommand *commands;
+    int command_count;
+    int background;
+    int connector;    // how this pipeline joins the next one
+    const char *source;
+} Pipeline;
+
+typedef struct {
+    Pipeline *pipelines;
+    int pipeline_count;
+} CommandList;
+
+typedef struct {
+    char text[2 * INPUT_MAX];
+    char source[2 * INPUT_MAX];
+    char *argv[2 * INPUT_MAX];
+    Redirect redirs[INPUT_MAX];
+    SimpleCommand commands[INPUT_MAX];
+    Pipeline pipelines[INPUT_MAX];
+    CommandList list;
+} ParsePool;
+
+ParsePool parse_pool;
+
+// Commands run inside the shell process instead of being spawned
+typedef struct {
+    const char *name;
+    int (*run)(char **argv);
+} Builtin;
+
+const Builtin *findBuiltin(const char *name);
+int runBuiltin(const Builtin *b, SimpleCommand *cmd);
+
+// Exit status of each stage of the last foreground pipeline
+int *pipeline_status = NULL;
+int pipeline_status_count = 0;
+int pipeline_status_capacity = 0;
+
+// Children's usage from the last foreground job, for time and SIMPLE_SHELL_TIMING
+struct rusage last_job_usage;
+int last_job_usage_valid = 0;
+
+// Input lines persist in an append-only file that is mapped read-only. A side index
+// (<file>.idx) holds each line's offset, so startup only scans lines added since
+// the index was last written.
+#define HISTORY_FILE ".simple_shell_history"
+#define HISTORY_PAGE 25
+#define HISTORY_INDEX_MAGIC 0x31494853  // "SHI1"
+
+typedef struct {
+    unsigned int magic;
+    unsigned int pad;
+    unsigned long long covered;  // file bytes described by the offsets that follow
+    unsigned long long count;
+} HistoryIndexHeader;
+
+typedef struct {
+    int fd;
+    int index_fd;
+    char *map;
+    size_t map_size;
+    size_t scanned;              // end of the last complete line seen
+    unsigned long long *offsets; // start of each line
+    size_t count;
+    size_t capacity;
+    size_t indexed;              // entries already written to the index file
+} HistoryStore;
+
+HistoryStore hist = { .fd = -1, .index_fd = -1 };
+
+// Command name -> absolute path cache, like bash's hash table
+#define PATH_CACHE_BUCKETS 256
+#define PATH_CACHE_RECHECK_SEC 1
+
+typedef struct PathCacheEntry {
+    char *name;
+    char *path;
+    unsigned long hits;
+    struct PathCacheEntry *next;
+} PathCacheEntry;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+} PathDir;
+
+PathCacheEntry *path_cache[PATH_CACHE_BUCKETS];
+char *path_cache_env = NULL;
+PathDir *path_dirs = NULL;
+int path_dir_count = 0;
+time_t path_cache_checked = 0;
+
+char cgroup_root[256];
+int cgroup_state = 0;  // 0 = not tried, 1 = ready, -1 = unavailable
+
+// Most recent commands launched this session; grows on demand up to COMMAND_LOG_MAX
+CommandLog *command_history = NULL;
+int history_capacity = 0;
+int history_dropped = 0;  // older entries trimmed to stay under COMMAND_LOG_MAX
+// Every job submitted this session; grows on demand
+SchedulerJob *scheduler_jobs = NULL;
+int dag_count = 0;
+int scheduler_jobs_capacity = 0;
+unsigned long scheduler_completions = 0;
 int history_count = 0;
 int job_count = 0;
 pid_t scheduler_pid;
-int global_tslice; 
+int global_tslice;  // 0 for "auto"
+const char *global_ncpu;
+
+// cd moves the shell, so the scheduler binary and journal are found from here
+char startup_dir[PATH_MAX];
+char journal_path[PATH_MAX + sizeof(JOURNAL_PATH) + 1];
+
+// Commands and pipelines started by the shell; each runs in its own process group
+#define JOB_TABLE_MAX 64
+
+// The exit summary keeps this many of the most recent commands
+#define COMMAND_LOG_MAX 1024
+
+enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+};
+
+typedef struct {
+    int used;
+    int id;               // %id in jobs, fg, bg, wait and kill
+    unsigned long seq;    // start/stop order; fg and bg default to the newest job
+    pid_t pgid;
+    pid_t *pids;          // 0 once reaped (or never started)
+    int *status;          // wait status of each stage
+    int count;
+    int live;             // stages not reaped yet
+    int state;
+    int background;
+    char *command;        // source text; the buffer is kept when the slot is reused
+    size_t command_cap;
+    int capacity;         // stages pids and status have room for; kept when the slot is reused
+    struct termios tmodes;
+    int have_tmodes;
+    struct rusage usage;  // children's usage, added up as each stage is reaped
+} Job;
+
+Job shell_jobs[JOB_TABLE_MAX];
+unsigned long job_seq = 0;
+
+// Only the reaper thread calls waitpid; it records everything under job_lock and
+// broadcasts job_changed. The SIGCHLD and SIGINT handlers just write to reap_pipe.
+pthread_mutex_t job_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+pthread_cond_t job_changed = PTHREAD_COND_INITIALIZER;
+int reap_pipe[2] = { -1, -1 };
+
+int job_control = 0;  // stdin is a terminal: hand it to foreground jobs
+pid_t shell_pgid;
+struct termios shell_tmodes;
+
+// -f and -c run without prompts, history or the execution summary
+int interactive = 1;
+
+typedef struct {
+    int fd;         // -1 once there is nothing more to read
+    char *buf;
+    size_t len;
+    size_t pos;
+    size_t cap;
+    long line_no;
+} LineReader;
+
+// Set by the exit builtin; main cleans up and leaves once the line finishes
+int exit_requested = 0;
+int exit_code = 0;
+
+// Set when Ctrl-C ends a foreground command; the rest of the line is skipped, as in sh
+int line_interrupted = 0;
 
 volatile sig_atomic_t received_sigint = 0;
+volatile sig_atomic_t scheduler_died = 0;
+volatile sig_atomic_t scheduler_crashed = 0;
+volatile sig_atomic_t shutting_down = 0;
+
+// Bump allocator: chunks are malloc'd as needed and everything is released at once
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;  // older chunk
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *head;         // newest chunk
+    size_t reserved;          // bytes in all chunks
+    size_t peak;
+    unsigned long allocs;     // arenaAlloc calls
+    unsigned long chunk_allocs;  // mallocs made for chunks
+    unsigned long resets;
+} Arena;
+
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+
+// Parse-adjacent and launch temporaries for the current line; reset after each line
+Arena line_arena;
+
+void *arenaAlloc(Arena *a, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    a->allocs++;
+    if (a->head == NULL || a->head->size - a->head->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        ArenaChunk *c = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (c == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        c->next = a->head;
+        c->size = chunk_size;
+        c->used = 0;
+        a->head = c;
+        a->reserved += chunk_size;
+        a->chunk_allocs++;
+        if (a->reserved > a->peak) a->peak = a->reserved;
+    }
+    void *ptr = a->head->data + a->head->used;
+    a->head->used += size;
+    return ptr;
+}
+
+char *arenaStrdup(Arena *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(arenaAlloc(a, len), s, len);
+}
+
+ArenaMark arenaMark(Arena *a) {
+    return (ArenaMark){ a->head, a->head != NULL ? a->head->used : 0 };
+}
+
+// Frees everything allocated since mark
+void arenaRelease(Arena *a, ArenaMark mark) {
+    while (a->head != mark.chunk) {
+        ArenaChunk *c = a->head;
+        a->head = c->next;
+        a->reserved -= c->size;
+        free(c);
+    }
+    if (a->head != NULL) a->head->used = mark.used;
+}
+
+// Empties the arena but keeps its first chunk, so steady-state lines never malloc
+void arenaReset(Arena *a) {
+    ArenaChunk *first = a->head;
+    while (first != NULL && first->next != NULL) first = first->next;
+    arenaRelease(a, (ArenaMark){ first, 0 });
+    a->resets++;
+}
+
+// Command log strings are kept once each in an arena, found again through an
+// open-addressed hash table; trimCommandLog rebuilds it from the entries it keeps
+typedef struct {
+    const char **slots;
+    size_t cap;
+    size_t count;
+    size_t bytes;
+    unsigned long lookups;
+    unsigned long hits;
+    Arena text;
+} StringStore;
+
+StringStore interned;
+
+unsigned long hashString(const char *s) {
+    unsigned long h = 1469598103934665603UL;  // FNV-1a
+    while (*s) h = (h ^ (unsigned char)*s++) * 1099511628211UL;
+    return h;
+}
+
+const char *intern(const char *s) {
+    StringStore *st = &interned;
+    st->lookups++;
+    if (st->count * 10 >= st->cap * 7) {
+        size_t cap = st->cap ? st->cap * 2 : 1024;
+        const char **slots = calloc(cap, sizeof(*slots));
+        if (slots == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < st->cap; i++) {
+            if (st->slots[i] == NULL) continue;
+            size_t k = hashString(st->slots[i]) & (cap - 1);
+            while (slots[k] != NULL) k = (k + 1) & (cap - 1);
+            slots[k] = st->slots[i];
+        }
+        free(st->slots);
+        st->slots = slots;
+        st->cap = cap;
+    }
+
+    size_t k = hashString(s) & (st->cap - 1);
+    for (; st->slots[k] != NULL; k = (k + 1) & (st->cap - 1)) {
+        if (strcmp(st->slots[k], s) == 0) {
+            st->hits++;
+            return st->slots[k];
+        }
+    }
+    st->slots[k] = arenaStrdup(&st->text, s);
+    st->count++;
+    st->bytes += strlen(s) + 1;
+    return st->slots[k];
+}
+
+void markCommandAsFinished(pid_t pid, const struct rusage *usage);
+int exitStatus(int status);
+
+// Folds one child's rusage into a running total
+void addUsage(struct rusage *sum, const struct rusage *ru) {
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss) sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_inblock += ru->ru_inblock;
+    sum->ru_oublock += ru->ru_oublock;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+// Subtracts before from after field by field (maxrss keeps after's high-water mark)
+void subUsage(struct rusage *after, const struct rusage *before) {
+    timersub(&after->ru_utime, &before->ru_utime, &after->ru_utime);
+    timersub(&after->ru_stime, &before->ru_stime, &after->ru_stime);
+    after->ru_minflt -= before->ru_minflt;
+    after->ru_majflt -= before->ru_majflt;
+    after->ru_inblock -= before->ru_inblock;
+    after->ru_oublock -= before->ru_oublock;
+    after->ru_nvcsw -= before->ru_nvcsw;
+    after->ru_nivcsw -= before->ru_nivcsw;
+}
+
+double elapsedSeconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double tvSeconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
 
 void sigchld_handler(int sig) {
-    int status;
-    pid_t pid;
-    
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        for (int i = 0; i < job_count; i++) {
-            if (scheduler_jobs[i].pid == pid && !scheduler_jobs[i].completed) {
-                scheduler_jobs[i].end_time = time(NULL);
-                scheduler_jobs[i].completed = 1;
-                scheduler_jobs[i].slices_run = 1; 
+    int saved_errno = errno;
+    write(reap_pipe[1], "c", 1);
+    errno = saved_errno;
+}
+
+const char *jobStateName(Job *j) {
+    static char buf[32];
+    if (j->state == JOB_RUNNING) return "Running";
+    if (j->state == JOB_STOPPED) return "Stopped";
+    int status = j->status[j->count - 1];
+    if (WIFSIGNALED(status)) return strsignal(WTERMSIG(status));
+    if (WEXITSTATUS(status) == 0) return "Done";
+    snprintf(buf, sizeof(buf), "Exit %d", WEXITSTATUS(status));
+    return buf;
+}
+
+// Applies one wait4 result; called by the reaper with job_lock held
+void recordChild(pid_t pid, int status, const struct rusage *ru) {
+    int exited = WIFEXITED(status) || WIFSIGNALED(status);
+
+    if (pid == scheduler_pid) {
+        if (!exited) return;
+        scheduler_pid = 0;
+        if (!shutting_down) {
+            scheduler_died = 1;
+            scheduler_crashed = !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+        return;
+    }
+
+    for (int i = 0; i < JOB_TABLE_MAX; i++) {
+        Job *j = &shell_jobs[i];
+        if (!j->used) continue;
+        for (int k = 0; k < j->count; k++) {
+            if (j->pids[k] != pid) continue;
+
+            if (WIFSTOPPED(status)) {
+                j->state = JOB_STOPPED;
+                j->seq = ++job_seq;
+                if (j->background) printf("\n[%d] Stopped    %s\n", j->id, j->command);
+            } else if (WIFCONTINUED(status)) {
+                j->state = JOB_RUNNING;
+            } else {
+                j->pids[k] = 0;
+                j->status[k] = status;
+                addUsage(&j->usage, ru);
+                if (--j->live == 0) {
+                    j->state = JOB_DONE;
+                    markCommandAsFinished(j->pgid, &j->usage);
+                    if (j->background) {
+                        printf("\n[%d] %-10s %s\n", j->id, jobStateName(j), j->command);
+                        // Only the main thread reuses slots, so a pending wait can still read it
+                        j->used = 0;
+                    }
+                }
+            }
+            return;
+        }
+    }
+
+    if (!exited) return;
+
+    // Let the scheduler (and a recovering one) see the job is gone, and whether jobs
+    // waiting on it may start
+    SharedJob *shared = NULL;
+    for (int i = 0; i < shared_mem->job_count; i++) {
+        if (shared_mem->jobs[i].job_pid == pid) {
+            shared = &shared_mem->jobs[i];
+            shared_mem->jobs[i].exit_status = exitStatus(status);
+            shared_mem->jobs[i].completed = 1;
+            shared_mem->jobs[i].end_time = time(NULL);
+#ifdef SCHEDULER_EMBEDDED
+            // Hand its slot to the next job now rather than at the next tick
+            scheduler_notify();
+#endif
+            break;
+        }
+    }
+
+    for (int i = 0; i < job_count; i++) {
+        if (scheduler_jobs[i].pid == pid && !scheduler_jobs[i].completed) {
+            scheduler_jobs[i].end_time = time(NULL);
+            scheduler_jobs[i].completed = 1;
+            // The scheduler's own count, as schedtop shows it
+            scheduler_jobs[i].slices_run = shared != NULL ? shared->slices_run : 0;
+            scheduler_jobs[i].exit_status = shared != NULL ? shared->exit_status : exitStatus(status);
+            scheduler_jobs[i].usage = *ru;
+            clock_gettime(CLOCK_MONOTONIC, &scheduler_jobs[i].end_mono);
+            scheduler_completions++;
+            if (!scheduler_jobs[i].quiet) {
                 printf("Job %s (PID: %d) completed\n", scheduler_jobs[i].name, pid);
             }
         }
     }
+    markCommandAsFinished(pid, ru);
+}
+
+void *reaper(void *arg) {
+    char buf[64];
+    while (1) {
+        if (read(reap_pipe[0], buf, sizeof(buf)) == -1 && errno != EINTR) break;
+
+        pthread_mutex_lock(&job_lock);
+        int status;
+        pid_t pid;
+        struct rusage ru;
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+            recordChild(pid, status, &ru);
+        }
+        fflush(stdout);
+        pthread_cond_broadcast(&job_changed);
+        pthread_mutex_unlock(&job_lock);
+    }
+    return NULL;
+}
+
+void start_reaper() {
+    if (pipe2(reap_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    // A full pipe already means a wakeup is pending, so the handlers never block
+    fcntl(reap_pipe[1], F_SETFL, O_NONBLOCK);
+
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old_mask);
+    pthread_t thread;
+    pthread_create(&thread, NULL, reaper, NULL);
+    pthread_detach(thread);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 }
+
 void sigint_handler(int sig) {
+    int saved_errno = errno;
     received_sigint = 1;
+    // Wake a foreground wait so it can pass the interrupt on
+    write(reap_pipe[1], "i", 1);
+    errno = saved_errno;
 }
 
 void init_shared_memory() {
@@ -113,6 +684,11 @@ void init_shared_memory() {
 
     
     memset(shared_mem, 0, sizeof(SharedMemory));
+
+    // Lets schedtop started from this shell find the segment after a cd
+    char shmid_str[20];
+    snprintf(shmid_str, sizeof(shmid_str), "%d", shmid);
+    setenv("SIMPLE_SHELL_SHMID", shmid_str, 1);
 }
 
 void cleanup_shared_memory() {
@@ -127,17 +703,57 @@ void cleanup_shared_memory() {
     }
 }
 
-void launch_scheduler(int ncpu, int tslice) {
-    scheduler_pid = fork();
-    if (scheduler_pid == 0) {
-        char ncpu_str[10], tslice_str[10], shmid_str[20];
-        sprintf(ncpu_str, "%d", ncpu);
-        sprintf(tslice_str, "%d", tslice);
+void launch_scheduler(const char *ncpu_str, int tslice, int recover) {
+#ifdef SCHEDULER_EMBEDDED
+    // The thread lives as long as the shell, so there is never anything to recover
+    if (scheduler_start(ncpu_str, tslice) == -1) exit(1);
+    return;
+#endif
+    // Hold the reaper off until scheduler_pid is known
+    pthread_mutex_lock(&job_lock);
+    shared_mem->scheduler_exiting = 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        char tslice_str[12], shmid_str[20];
+        if (tslice > 0) sprintf(tslice_str, "%d", tslice);
+        else strcpy(tslice_str, "auto");
         sprintf(shmid_str, "%d", shmid);
-        execl("./s", "simple-scheduler", ncpu_str, tslice_str, shmid_str, NULL);
+        if (chdir(startup_dir) == -1) perror("chdir");
+        execl("./s", "simple-scheduler", ncpu_str, tslice_str, shmid_str,
+              recover ? "recover" : NULL, NULL);
         perror("Failed to launch scheduler");
         exit(1);
     }
+    scheduler_pid = pid;
+    pthread_mutex_unlock(&job_lock);
+}
+
+// Relaunches a scheduler that crashed, or that exited while idle when new work arrives
+void ensure_scheduler_running(int have_new_work) {
+    // A scheduler on its way out may have missed the job just published; let it go
+    if (have_new_work && scheduler_pid > 0) {
+        pthread_mutex_lock(&job_lock);
+        while (scheduler_pid > 0 && __atomic_load_n(&shared_mem->scheduler_exiting, __ATOMIC_SEQ_CST)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&job_changed, &job_lock, &deadline);
+        }
+        pthread_mutex_unlock(&job_lock);
+    }
+    if (!scheduler_died) return;
+    if (!scheduler_crashed && !have_new_work) return;
+
+    if (scheduler_crashed) {
+        printf("Scheduler exited unexpectedly; relaunching and recovering from journal\n");
+    }
+    scheduler_died = 0;
+    scheduler_crashed = 0;
+    launch_scheduler(global_ncpu, global_tslice, 1);
 }
 
 int is_executable(const char *path) {
@@ -152,354 +768,2918 @@ int is_executable(const char *path) {
     return 1;
 }
 
-void *output_handler(void *arg) {
-    int pipe_fd = *(int *)arg;
-    free(arg);
+int write_cgroup_file(const char *dir, const char *file, const char *value) {
+    char path[768];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
 
-    char buffer[4096];
-    ssize_t bytes_read;
+// Creates the shell's cgroup v2 subtree and enables the controllers job leaves need
+int init_cgroup_root() {
+    if (cgroup_state != 0) return cgroup_state;
+    cgroup_state = -1;
 
-    while ((bytes_read = read(pipe_fd, buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        printf("%s", buffer);
-        fflush(stdout);
+    if (access(CGROUP_FS "/cgroup.controllers", F_OK) == -1) {
+        printf("Warning: cgroup v2 is not mounted at %s; jobs run without resource limits\n", CGROUP_FS);
+        return cgroup_state;
     }
 
-    close(pipe_fd);
-    return NULL;
+    char *root = getenv("SIMPLE_SHELL_CGROUP");
+    if (root != NULL) {
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s", root);
+    } else {
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s/simple-shell.%d", CGROUP_FS, getpid());
+    }
+
+    if (mkdir(cgroup_root, 0755) == -1 && errno != EEXIST) {
+        printf("Warning: cannot create cgroup %s: %s\n", cgroup_root, strerror(errno));
+        return cgroup_state;
+    }
+
+    // The parent may already delegate these; failures surface when limits are written
+    char parent[256];
+    snprintf(parent, sizeof(parent), "%s", cgroup_root);
+    char *slash = strrchr(parent, '/');
+    if (slash != NULL && slash != parent) {
+        *slash = '\0';
+        write_cgroup_file(parent, "cgroup.subtree_control", "+cpu +memory +io");
+    }
+    if (write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+cpu +memory +io") == -1) {
+        printf("Warning: cannot enable cpu/memory/io controllers in %s: %s\n", cgroup_root, strerror(errno));
+    }
+
+    cgroup_state = 1;
+    return cgroup_state;
 }
 
-void handle_submit(char *program, char *priority_str) {
-    if (program == NULL || strlen(program) == 0) {
-        printf("Usage: submit <program/command> [priority]\n");
-        return;
+// Prepares the leaf cgroup for a job (or its priority class) and applies its limits
+int setup_job_cgroup(SubmitOptions *opts, int priority, int seq, char *leaf, size_t leaf_size) {
+    if (init_cgroup_root() != 1) return -1;
+
+    if (opts->per_class) {
+        snprintf(leaf, leaf_size, "%s/prio-%d", cgroup_root, priority);
+    } else {
+        snprintf(leaf, leaf_size, "%s/job-%d", cgroup_root, seq);
+    }
+    if (mkdir(leaf, 0755) == -1 && errno != EEXIST) {
+        printf("Warning: cannot create cgroup %s: %s\n", leaf, strerror(errno));
+        return -1;
     }
 
-    int priority = DEFAULT_PRIORITY;
-    if (priority_str != NULL) {
-        priority = atoi(priority_str);
-        if (priority < 1 || priority > MAX_PRIORITY) {
-            printf("Invalid priority value. Using default priority %d\n", DEFAULT_PRIORITY);
-            priority = DEFAULT_PRIORITY;
+    struct { const char *file; const char *value; } settings[] = {
+        { "cpu.max", opts->cpu_max },
+        { "memory.max", opts->memory_max },
+        { "io.max", opts->io_max },
+    };
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        if (settings[i].value[0] == '\0') continue;
+        if (write_cgroup_file(leaf, settings[i].file, settings[i].value) == -1) {
+            printf("Warning: cannot set %s to '%s': %s\n", settings[i].file, settings[i].value, strerror(errno));
         }
     }
+    return 0;
+}
 
-    
-    char *path = NULL;
-    char *path_env = getenv("PATH");
-    char *path_copy = strdup(path_env);
-    char *dir = strtok(path_copy, ":");
-    
-    while (dir != NULL) {
-        char full_path[INPUT_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir, program);
-        if (access(full_path, X_OK) == 0) {
-            path = strdup(full_path);
+// Reads "<key> <value>" from a flat-keyed cgroup file such as cpu.stat
+long long read_cgroup_key(const char *dir, const char *file, const char *key) {
+    char path[768], line[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    long long value = -1;
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+            value = atoll(line + key_len + 1);
             break;
         }
-        dir = strtok(NULL, ":");
     }
-    free(path_copy);
+    fclose(f);
+    return value;
+}
 
-   
-    if (path == NULL) {
-        char program_path[INPUT_MAX];
-        if (program[0] != '.' && program[0] != '/') {
-            snprintf(program_path, sizeof(program_path), "./%s", program);
-        } else {
-            strncpy(program_path, program, sizeof(program_path) - 1);
+long long read_cgroup_value(const char *dir, const char *file) {
+    char path[768];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    long long value = -1;
+    if (fscanf(f, "%lld", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+// Total stall time in microseconds from the "some" line of a PSI file
+long long read_cgroup_pressure(const char *dir, const char *file) {
+    char path[768], line[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    long long total = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = strstr(line, "total=");
+        if (strncmp(line, "some", 4) == 0 && p != NULL) {
+            total = atoll(p + 6);
+            break;
         }
-        
-        if (access(program_path, X_OK) == 0) {
-            path = strdup(program_path);
+    }
+    fclose(f);
+    return total;
+}
+
+// Sums rbytes/wbytes over every device in io.stat
+void read_cgroup_io(const char *dir, long long *rbytes, long long *wbytes) {
+    char path[768], line[512];
+    snprintf(path, sizeof(path), "%s/io.stat", dir);
+    *rbytes = *wbytes = -1;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return;
+
+    *rbytes = *wbytes = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p;
+        if ((p = strstr(line, "rbytes=")) != NULL) *rbytes += atoll(p + 7);
+        if ((p = strstr(line, "wbytes=")) != NULL) *wbytes += atoll(p + 7);
+    }
+    fclose(f);
+}
+
+void remove_job_cgroups() {
+    for (int i = 0; i < job_count; i++) {
+        if (scheduler_jobs[i].cgroup[0] != '\0') {
+            rmdir(scheduler_jobs[i].cgroup);
         }
     }
+    if (cgroup_state == 1 && getenv("SIMPLE_SHELL_CGROUP") == NULL) {
+        rmdir(cgroup_root);
+    }
+}
 
-    if (path == NULL) {
-        printf("Error: Command/Program '%s' not found or not executable\n", program);
-        return;
+unsigned int hash_string(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h = (h ^ (unsigned char)*str++) * 16777619u;
     }
+    return h;
+}
 
-   
-    int output_pipe[2];
-    if (pipe(output_pipe) == -1) {
-        perror("Pipe creation failed");
-        free(path);
+void flush_path_cache() {
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        PathCacheEntry *e = path_cache[i];
+        while (e != NULL) {
+            PathCacheEntry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        path_cache[i] = NULL;
+    }
+}
+
+void load_path_dirs(const char *path_env) {
+    for (int i = 0; i < path_dir_count; i++) free(path_dirs[i].dir);
+    free(path_dirs);
+    free(path_cache_env);
+    path_dirs = NULL;
+    path_dir_count = 0;
+    path_cache_env = strdup(path_env);
+
+    char *copy = strdup(path_env);
+    for (char *dir = strtok(copy, ":"); dir != NULL; dir = strtok(NULL, ":")) {
+        path_dirs = realloc(path_dirs, (path_dir_count + 1) * sizeof(PathDir));
+        path_dirs[path_dir_count].dir = strdup(dir);
+        struct stat st;
+        if (stat(dir, &st) == 0) path_dirs[path_dir_count].mtime = st.st_mtim;
+        else memset(&path_dirs[path_dir_count].mtime, 0, sizeof(struct timespec));
+        path_dir_count++;
+    }
+    free(copy);
+    path_cache_checked = time(NULL);
+}
+
+// Drops the cache when PATH changes, or (at most once a second) when a PATH directory changes
+void revalidate_path_cache() {
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) path_env = "";
+
+    if (path_cache_env == NULL || strcmp(path_cache_env, path_env) != 0) {
+        flush_path_cache();
+        load_path_dirs(path_env);
         return;
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-       
-        sigset_t mask;
-        sigemptyset(&mask);
-        sigaddset(&mask, SIGUSR1);
-        sigprocmask(SIG_BLOCK, &mask, NULL);
+    time_t now = time(NULL);
+    if (now - path_cache_checked < PATH_CACHE_RECHECK_SEC) return;
+    path_cache_checked = now;
+
+    int changed = 0;
+    for (int i = 0; i < path_dir_count; i++) {
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (stat(path_dirs[i].dir, &st) == 0) mtime = st.st_mtim;
+        if (mtime.tv_sec != path_dirs[i].mtime.tv_sec || mtime.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            path_dirs[i].mtime = mtime;
+            changed = 1;
+        }
+    }
+    if (changed) flush_path_cache();
+}
 
-       
-        dup2(output_pipe[1], STDOUT_FILENO);
-        dup2(output_pipe[1], STDERR_FILENO);
-        close(output_pipe[0]);
-        close(output_pipe[1]);
-        
-        execl(path, program, NULL);
-        perror("Failed to execute program");
-        exit(1);
-    } else if (pid > 0) {
-       
-        close(output_pipe[1]); 
+// Resolves a command name to an executable path; names containing '/' are used as-is
+const char *lookup_command(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return access(name, X_OK) == 0 ? name : NULL;
+    }
 
-   
-        int idx = shared_mem->job_count;
-        shared_mem->jobs[idx].job_pid = pid;
-        strncpy(shared_mem->jobs[idx].name, program, sizeof(shared_mem->jobs[idx].name) - 1);
-        shared_mem->jobs[idx].priority = priority;
-        shared_mem->jobs[idx].is_new = 1;
-        shared_mem->jobs[idx].completed = 0;
-        shared_mem->jobs[idx].start_time = time(NULL);
-        shared_mem->job_count++;
+    revalidate_path_cache();
+    unsigned int bucket = hash_string(name) % PATH_CACHE_BUCKETS;
+    for (PathCacheEntry *e = path_cache[bucket]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    char full_path[PATH_MAX];
+    for (int i = 0; i < path_dir_count; i++) {
+        snprintf(full_path, sizeof(full_path), "%s/%s", path_dirs[i].dir, name);
+        struct stat st;
+        if (access(full_path, X_OK) == 0 && stat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
+            PathCacheEntry *e = malloc(sizeof(PathCacheEntry));
+            e->name = strdup(name);
+            e->path = strdup(full_path);
+            e->hits = 1;
+            e->next = path_cache[bucket];
+            path_cache[bucket] = e;
+            return e->path;
+        }
+    }
+    return NULL;
+}
+
+// hash [-r]
+int handle_hash(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+        flush_path_cache();
+        return 0;
+    }
+    revalidate_path_cache();
+    printf("%-8s %s\n", "hits", "command");
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        for (PathCacheEntry *e = path_cache[i]; e != NULL; e = e->next) {
+            printf("%-8lu %s\n", e->hits, e->path);
+        }
+    }
+    return 0;
+}
+
+// Writes each complete line as "[name:pid] line" with one writev per batch
+void flush_output_lines(OutputStream *st, char *data, size_t len, int at_eof) {
+    struct iovec iov[IOV_MAX];
+    int n = 0;
+    char newline = '\n';
+
+    while (len > 0 || (at_eof && st->partial_len > 0)) {
+        char *nl = len > 0 ? memchr(data, '\n', len) : NULL;
+        if (nl == NULL) {
+            size_t room = sizeof(st->partial) - st->partial_len;
+            size_t take = len < room ? len : room;
+            memcpy(st->partial + st->partial_len, data, take);
+            st->partial_len += take;
+            data += take;
+            len -= take;
+            // Over-long lines and a trailing unterminated line are emitted as-is
+            if (st->partial_len < sizeof(st->partial) && !(at_eof && len == 0)) break;
+            if (n + 3 > IOV_MAX) {
+                writev(STDOUT_FILENO, iov, n);
+                n = 0;
+            }
+            iov[n++] = (struct iovec){ st->tag, st->tag_len };
+            iov[n++] = (struct iovec){ st->partial, st->partial_len };
+            iov[n++] = (struct iovec){ &newline, 1 };
+            writev(STDOUT_FILENO, iov, n);
+            n = 0;
+            st->partial_len = 0;
+            continue;
+        }
+
+        size_t line_len = nl - data + 1;
+        if (n + 3 > IOV_MAX) {
+            writev(STDOUT_FILENO, iov, n);
+            n = 0;
+        }
+        iov[n++] = (struct iovec){ st->tag, st->tag_len };
+        if (st->partial_len > 0) {
+            // The partial buffer is flushed below, before it can be reused
+            iov[n++] = (struct iovec){ st->partial, st->partial_len };
+            iov[n++] = (struct iovec){ data, line_len };
+            writev(STDOUT_FILENO, iov, n);
+            n = 0;
+            st->partial_len = 0;
+        } else {
+            iov[n++] = (struct iovec){ data, line_len };
+        }
+        data += line_len;
+        len -= line_len;
+    }
+
+    if (n > 0) writev(STDOUT_FILENO, iov, n);
+}
+
+JobCapture *create_capture(pid_t pid) {
+    size_t size = CAPTURE_RING_DEFAULT;
+    char *env = getenv("SIMPLE_SHELL_CAPTURE_KB");
+    if (env != NULL && atoi(env) > 0) size = (size_t)atoi(env) * 1024;
+
+    char *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        perror("Cannot map capture buffer");
+        return NULL;
+    }
+
+    JobCapture *cap = calloc(1, sizeof(JobCapture));
+    cap->pid = pid;
+    cap->ring = ring;
+    cap->ring_size = size;
+    cap->spill_fd = -1;
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->changed, NULL);
+    return cap;
+}
+
+void destroy_capture(JobCapture *cap) {
+    munmap(cap->ring, cap->ring_size);
+    if (cap->spill_fd != -1) {
+        close(cap->spill_fd);
+        unlink(cap->spill_path);
+    }
+    pthread_mutex_destroy(&cap->lock);
+    pthread_cond_destroy(&cap->changed);
+    free(cap);
+}
+
+// Appends to the spill file, opening it on first use; caller holds cap->lock
+int capture_spill(JobCapture *cap, const char *data, size_t len) {
+    if (cap->spill_fd == -1) {
+        const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+        snprintf(cap->spill_path, sizeof(cap->spill_path), "%s/simple-shell-%d-job-%d.log", dir, getpid(), cap->pid);
+        cap->spill_fd = open(cap->spill_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+        if (cap->spill_fd == -1) return -1;
+    }
+    while (len > 0) {
+        ssize_t w = write(cap->spill_fd, data, len);
+        if (w <= 0) return -1;
+        data += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// Moves the oldest len bytes of the ring out to the spill file; caller holds cap->lock
+void capture_spill_ring(JobCapture *cap, size_t len) {
+    while (len > 0) {
+        size_t off = cap->spilled % cap->ring_size;
+        size_t chunk = cap->ring_size - off < len ? cap->ring_size - off : len;
+        // If the disk is full the oldest bytes are dropped; memory stays capped either way
+        capture_spill(cap, cap->ring + off, chunk);
+        cap->spilled += chunk;
+        len -= chunk;
+    }
+}
+
+void capture_append(JobCapture *cap, const char *data, size_t len) {
+    pthread_mutex_lock(&cap->lock);
+
+    if (len >= cap->ring_size) {
+        capture_spill_ring(cap, cap->head - cap->spilled);
+        size_t direct = len - cap->ring_size;
+        capture_spill(cap, data, direct);
+        cap->spilled += direct;
+        cap->head += direct;
+        data += direct;
+        len -= direct;
+    }
+
+    size_t used = cap->head - cap->spilled;
+    if (used + len > cap->ring_size) {
+        capture_spill_ring(cap, used + len - cap->ring_size);
+    }
+
+    while (len > 0) {
+        size_t off = cap->head % cap->ring_size;
+        size_t chunk = cap->ring_size - off < len ? cap->ring_size - off : len;
+        memcpy(cap->ring + off, data, chunk);
+        cap->head += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    pthread_cond_broadcast(&cap->changed);
+    pthread_mutex_unlock(&cap->lock);
+}
+
+// Copies logical bytes [off, off + len) into buf; caller holds cap->lock
+size_t capture_read(JobCapture *cap, size_t off, char *buf, size_t len) {
+    size_t copied = 0;
+    while (copied < len && off < cap->head) {
+        size_t chunk;
+        if (off < cap->spilled) {
+            chunk = cap->spilled - off < len - copied ? cap->spilled - off : len - copied;
+            ssize_t n = cap->spill_fd == -1 ? -1 : pread(cap->spill_fd, buf + copied, chunk, off);
+            if (n <= 0) break;
+            chunk = n;
+        } else {
+            size_t pos = off % cap->ring_size;
+            chunk = cap->ring_size - pos;
+            if (chunk > cap->head - off) chunk = cap->head - off;
+            if (chunk > len - copied) chunk = len - copied;
+            memcpy(buf + copied, cap->ring + pos, chunk);
+        }
+        copied += chunk;
+        off += chunk;
+    }
+    return copied;
+}
+
+// Plain read/write for destinations that cannot take splice(), such as most terminals
+ssize_t copy_output(OutputStream *st, size_t len) {
+    static char buffer[65536];
+    ssize_t n = read(st->fd, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+    for (ssize_t off = 0; n > 0 && off < n; ) {
+        ssize_t w = write(st->dest_fd, buffer + off, n - off);
+        if (w <= 0) return -1;
+        off += w;
+    }
+    return n;
+}
+
+// Moves up to len bytes from the job pipe to the destination, falling back to a copy
+ssize_t move_output(OutputStream *st, size_t len) {
+    if (!st->copy_fallback) {
+        ssize_t n = splice(st->fd, NULL, st->dest_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n >= 0 || errno != EINVAL) return n;
+        st->copy_fallback = 1;
+    }
+    return copy_output(st, len);
+}
+
+// Drains a job pipe with splice (and tee for a second copy); returns 0 once the job closed it
+int splice_output(OutputStream *st) {
+    while (1) {
+        size_t len = OUTPUT_SPLICE_CHUNK;
+        if (st->tee_fd != -1) {
+            ssize_t n = tee(st->fd, st->tee_pipe[1], len, SPLICE_F_NONBLOCK);
+            if (n == 0) return 0;
+            if (n < 0) return errno == EAGAIN || errno == EINTR;
+            for (ssize_t left = n; left > 0; ) {
+                ssize_t w = splice(st->tee_pipe[0], NULL, st->tee_fd, NULL, left, SPLICE_F_MOVE);
+                if (w <= 0) return 0;
+                left -= w;
+            }
+            len = n;
+        }
+
+        // After a tee exactly len bytes are buffered, so this cannot block
+        size_t moved = 0;
+        while (moved < len) {
+            ssize_t n = move_output(st, len - moved);
+            if (n == 0) return 0;
+            if (n < 0) {
+                if ((errno == EAGAIN || errno == EINTR) && st->tee_fd == -1) return 1;
+                if (errno == EAGAIN || errno == EINTR) continue;
+                return 0;
+            }
+            moved += n;
+            if (st->tee_fd == -1) break;
+        }
+    }
+}
+
+void close_output_stream(OutputStream *st) {
+    epoll_ctl(output_epoll_fd, EPOLL_CTL_DEL, st->fd, NULL);
+    close(st->fd);
+    if (st->dest_fd != STDOUT_FILENO) close(st->dest_fd);
+    if (st->tee_fd != -1) {
+        close(st->tee_fd);
+        close(st->tee_pipe[0]);
+        close(st->tee_pipe[1]);
+    }
+    free(st);
+}
+
+void *output_multiplexer(void *arg) {
+    struct epoll_event events[OUTPUT_EVENTS_MAX];
+    static char buffer[65536];
+
+    while (1) {
+        int ready = epoll_wait(output_epoll_fd, events, OUTPUT_EVENTS_MAX, -1);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return NULL;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            OutputStream *st = events[i].data.ptr;
+            if (st->mode == OUTPUT_SPLICE) {
+                if (!splice_output(st)) close_output_stream(st);
+                continue;
+            }
+
+            ssize_t bytes_read = read(st->fd, buffer, sizeof(buffer));
+            if (bytes_read > 0) {
+                if (st->mode == OUTPUT_CAPTURE) {
+                    capture_append(st->capture, buffer, bytes_read);
+                } else {
+                    flush_output_lines(st, buffer, bytes_read, 0);
+                }
+            } else if (bytes_read == 0 || errno != EINTR) {
+                if (st->mode == OUTPUT_CAPTURE) {
+                    pthread_mutex_lock(&st->capture->lock);
+                    st->capture->done = 1;
+                    pthread_cond_broadcast(&st->capture->changed);
+                    pthread_mutex_unlock(&st->capture->lock);
+                } else {
+                    flush_output_lines(st, NULL, 0, 1);
+                }
+                close_output_stream(st);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Hands a job's pipe to the output thread, starting the thread on first use.
+// dest_fd and tee_fd are owned by the stream from here on.
+void watch_job_output(int fd, pid_t pid, const char *name, int mode, int dest_fd, int tee_fd,
+                      JobCapture *capture) {
+    if (output_epoll_fd == -1) {
+        output_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (output_epoll_fd == -1) {
+            perror("epoll_create1 failed");
+            close(fd);
+            if (dest_fd != STDOUT_FILENO) close(dest_fd);
+            if (tee_fd != -1) close(tee_fd);
+            return;
+        }
+        // Signals stay with the main thread, so Ctrl-C interrupts its blocking calls
+        sigset_t all, old_mask;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old_mask);
+        pthread_t thread;
+        pthread_create(&thread, NULL, output_multiplexer, NULL);
+        pthread_detach(thread);
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    }
+
+    OutputStream *st = malloc(sizeof(OutputStream));
+    st->fd = fd;
+    st->pid = pid;
+    st->mode = mode;
+    st->dest_fd = dest_fd;
+    st->tee_fd = tee_fd;
+    st->copy_fallback = 0;
+    st->capture = capture;
+    st->partial_len = 0;
+    if (mode == OUTPUT_SPLICE) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (tee_fd != -1 && pipe2(st->tee_pipe, O_CLOEXEC) == -1) {
+        perror("Tee pipe creation failed");
+        close(tee_fd);
+        st->tee_fd = -1;
+    }
+    const char *base = strrchr(name, '/');
+    st->tag_len = snprintf(st->tag, sizeof(st->tag), "[%.48s:%d] ", base ? base + 1 : name, pid);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = st };
+    if (epoll_ctl(output_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl failed");
+        close_output_stream(st);
+    }
+}
+
+// Finds a shared slot for a new job, reusing ones the scheduler is done with
+int alloc_shared_slot() {
+    for (int i = 0; i < shared_mem->job_count; i++) {
+        if (shared_slot_free(shared_mem, i)) return i;
+    }
+    if (shared_mem->job_count < MAX_JOBS) return shared_mem->job_count;
+    return -1;
+}
+
+SchedulerJob *find_scheduler_job(pid_t pid) {
+    for (int i = 0; i < job_count; i++) {
+        if (scheduler_jobs[i].pid == pid) return &scheduler_jobs[i];
+    }
+    return NULL;
+}
+
+// Starts args[0] (with args as its argv) paused and hands it to the scheduler;
+// returns its index in scheduler_jobs, or -1
+int handle_submit(char **args, char *priority_str, SubmitOptions *opts) {
+    char *program = args[0];
+    if (program == NULL || strlen(program) == 0) {
+        printf("Usage: submit <program/command> [priority] [--after PID[,PID...]] [--cpu-max QUOTA[/PERIOD]] "
+               "[--mem-max BYTES] [--io-max MAJ:MIN,KEY=VAL,...] [--cgroup-class] "
+               "[--out FILE | --tee FILE | --raw | --capture] [--pipe-size BYTES] [-- ARGS...]\n");
+        return -1;
+    }
+
+    int slot = alloc_shared_slot();
+    if (slot == -1) {
+        printf("Error: %d jobs already waiting for the scheduler\n", MAX_JOBS);
+        return -1;
+    }
+
+    int priority = DEFAULT_PRIORITY;
+    if (priority_str != NULL) {
+        priority = atoi(priority_str);
+        if (priority < 1 || priority > MAX_PRIORITY) {
+            printf("Invalid priority value. Using default priority %d\n", DEFAULT_PRIORITY);
+            priority = DEFAULT_PRIORITY;
+        }
+    }
+
+    // Parents must be scheduler jobs of this shell that have not failed
+    pthread_mutex_lock(&job_lock);
+    for (int d = 0; d < opts->after_count; d++) {
+        SchedulerJob *parent = find_scheduler_job(opts->after[d]);
+        if (parent == NULL || (parent->completed && parent->exit_status != 0)) {
+            if (parent == NULL) printf("Error: no submitted job with PID %d\n", opts->after[d]);
+            else printf("Error: job %s (PID: %d) already failed with status %d\n",
+                        parent->name, parent->pid, parent->exit_status);
+            pthread_mutex_unlock(&job_lock);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&job_lock);
+
+    
+    char path[PATH_MAX];
+    const char *resolved = NULL;
+    if (strchr(program, '/') == NULL) {
+        resolved = lookup_command(program);
+    }
+
+   
+    if (resolved == NULL) {
+        char program_path[INPUT_MAX];
+        if (program[0] != '.' && program[0] != '/') {
+            snprintf(program_path, sizeof(program_path), "./%s", program);
+        } else {
+            snprintf(program_path, sizeof(program_path), "%s", program);
+        }
+        
+        resolved = lookup_command(program_path);
+    }
+
+    if (resolved == NULL) {
+        printf("Error: Command/Program '%s' not found or not executable\n", program);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s", resolved);
+
+   
+    char leaf[512] = "";
+    if (opts->cpu_max[0] || opts->memory_max[0] || opts->io_max[0] || opts->per_class) {
+        if (setup_job_cgroup(opts, priority, job_count, leaf, sizeof(leaf)) == -1) {
+            leaf[0] = '\0';
+        }
+    }
+
+    int mode = OUTPUT_TAGGED, dest_fd = STDOUT_FILENO, tee_fd = -1;
+    const char *file = opts->out_path[0] ? opts->out_path : opts->tee_path;
+    if (file[0] != '\0') {
+        int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            perror("Cannot open job output file");
+            return -1;
+        }
+        if (opts->out_path[0]) dest_fd = fd;
+        else tee_fd = fd;
+    }
+    if (file[0] != '\0' || opts->raw) {
+        mode = OUTPUT_SPLICE;
+    } else if (opts->capture || getenv("SIMPLE_SHELL_CAPTURE") != NULL) {
+        mode = OUTPUT_CAPTURE;
+    }
+
+    int output_pipe[2];
+    if (pipe2(output_pipe, O_CLOEXEC) == -1) {
+        perror("Pipe creation failed");
+        if (dest_fd != STDOUT_FILENO) close(dest_fd);
+        if (tee_fd != -1) close(tee_fd);
+        return -1;
+    }
+
+    int pipe_size = opts->pipe_size;
+    if (pipe_size <= 0 && getenv("SIMPLE_SHELL_PIPE_SZ") != NULL) {
+        pipe_size = atoi(getenv("SIMPLE_SHELL_PIPE_SZ"));
+    }
+    if (pipe_size > 0 && fcntl(output_pipe[0], F_SETPIPE_SZ, pipe_size) == -1) {
+        perror("F_SETPIPE_SZ failed");
+    }
+
+    // The scheduler may signal the pid as soon as the slot below is published, so the
+    // child starts with SIGUSR1/SIGUSR2 blocked until dummy_main installs its handler
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    pthread_mutex_lock(&job_lock);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+
+       
+        dup2(output_pipe[1], STDOUT_FILENO);
+        dup2(output_pipe[1], STDERR_FILENO);
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+
+        // Move ourselves into the job's leaf before exec so limits apply from the start
+        if (leaf[0] != '\0' && write_cgroup_file(leaf, "cgroup.procs", "0") == -1) {
+            perror("Failed to join job cgroup");
+        }
+        
+        execv(path, args);
+        perror("Failed to execute program");
+        exit(1);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (pid > 0) {
+       
+        close(output_pipe[1]); 
+
+   
+        // is_new goes last so the scheduler never picks up a half-written slot
+        SharedJob *shared = &shared_mem->jobs[slot];
+        shared->job_pid = pid;
+        strncpy(shared->name, program, sizeof(shared->name) - 1);
+        shared->priority = priority;
+        shared->completed = 0;
+        shared->start_time = time(NULL);
+        shared->end_time = 0;
+        shared->slices_run = 0;
+        shared->exit_status = 0;
+        shared->critical_path = 1;
+        shared->after_count = 0;
+        int dag = opts->dag, depth = 1;
+        for (int d = 0; d < opts->after_count; d++) {
+            SchedulerJob *parent = find_scheduler_job(opts->after[d]);
+            if (dag == 0) dag = parent->dag ? parent->dag : ++dag_count;
+            if (parent->dag == 0) parent->dag = dag;
+            if (parent->depth + 1 > depth) depth = parent->depth + 1;
+            // One that has already exited 0 needs no waiting for; one that failed since
+            // the check above stays listed so the scheduler cancels this job
+            if (!parent->completed || parent->exit_status != 0) {
+                shared->after[shared->after_count++] = parent->pid;
+            }
+        }
+        if (slot == shared_mem->job_count) shared_mem->job_count++;
+        __atomic_store_n(&shared->is_new, 1, __ATOMIC_SEQ_CST);
+
+        if (!opts->quiet && shared->after_count > 0) {
+            printf("Submitted job: %s with PID: %d, Priority: %d, held for %d job(s)\n",
+                   program, pid, priority, shared->after_count);
+        } else if (!opts->quiet) {
+            printf("Submitted job: %s with PID: %d, Priority: %d\n", program, pid, priority);
+        }
+
+        
+        JobCapture *capture = NULL;
+        if (mode == OUTPUT_CAPTURE && (capture = create_capture(pid)) == NULL) {
+            mode = OUTPUT_TAGGED;
+        }
+        watch_job_output(output_pipe[0], pid, program, mode, dest_fd, tee_fd, capture);
+
+       
+        if (job_count == scheduler_jobs_capacity) {
+            int capacity = scheduler_jobs_capacity ? scheduler_jobs_capacity * 2 : 64;
+            SchedulerJob *grown = realloc(scheduler_jobs, capacity * sizeof(SchedulerJob));
+            if (grown == NULL) {
+                // Still the shell's child; the reaper just won't report on it
+                perror("realloc");
+                pthread_mutex_unlock(&job_lock);
+                ensure_scheduler_running(1);
+                return -1;
+            }
+            scheduler_jobs = grown;
+            scheduler_jobs_capacity = capacity;
+        }
+        memset(&scheduler_jobs[job_count], 0, sizeof(SchedulerJob));
+        scheduler_jobs[job_count].pid = pid;
+        strncpy(scheduler_jobs[job_count].name, program, sizeof(scheduler_jobs[job_count].name) - 1);
+        scheduler_jobs[job_count].priority = priority;
+        scheduler_jobs[job_count].start_time = time(NULL);
+        clock_gettime(CLOCK_MONOTONIC, &scheduler_jobs[job_count].start_mono);
+        scheduler_jobs[job_count].completed = 0;
+        scheduler_jobs[job_count].slices_run = 0;
+        snprintf(scheduler_jobs[job_count].cgroup, sizeof(scheduler_jobs[job_count].cgroup), "%s", leaf);
+        scheduler_jobs[job_count].capture = capture;
+        scheduler_jobs[job_count].quiet = opts->quiet;
+        scheduler_jobs[job_count].dag = dag;
+        scheduler_jobs[job_count].depth = depth;
+        int index = job_count++;
+        pthread_mutex_unlock(&job_lock);
+
+        // Outside job_lock: waiting out a scheduler that is exiting needs the reaper
+        ensure_scheduler_running(1);
+#ifdef SCHEDULER_EMBEDDED
+        scheduler_notify();
+#endif
+        return index;
+    } else {
+        pthread_mutex_unlock(&job_lock);
+        perror("Fork failed");
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+        if (dest_fd != STDOUT_FILENO) close(dest_fd);
+        if (tee_fd != -1) close(tee_fd);
+    }
+
+    return -1;
+}
+
+
+
+// submit <program> [priority] [--after PID[,PID...]] [--cpu-max Q[/P]] [--mem-max B]
+//        [--io-max MAJ:MIN,K=V,...] [--cgroup-class] [--out FILE | --tee FILE | --raw | --capture]
+//        [--pipe-size BYTES] [-- ARGS...]
+int parse_submit(char **argv) {
+    SubmitOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    char *program = NULL, *priority_str = NULL;
+
+    char **job_args = NULL;
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *token = argv[i];
+        if (strcmp(token, "--") == 0) {
+            job_args = &argv[i];
+            break;
+        } else if (strcmp(token, "--cgroup-class") == 0) {
+            opts.per_class = 1;
+        } else if (strcmp(token, "--raw") == 0) {
+            opts.raw = 1;
+        } else if (strcmp(token, "--capture") == 0) {
+            opts.capture = 1;
+        } else if (strcmp(token, "--after") == 0) {
+            char *list = argv[++i];
+            if (list == NULL) {
+                printf("Error: --after needs a value\n");
+                return 1;
+            }
+            for (char *pid_str = strtok(list, ","); pid_str != NULL; pid_str = strtok(NULL, ",")) {
+                char *end;
+                long pid = strtol(pid_str, &end, 10);
+                if (*end != '\0' || pid <= 0 || opts.after_count == MAX_JOB_DEPS) {
+                    printf("Error: --after takes up to %d job PIDs separated by commas\n", MAX_JOB_DEPS);
+                    return 1;
+                }
+                opts.after[opts.after_count++] = pid;
+            }
+        } else if (strcmp(token, "--cpu-max") == 0 || strcmp(token, "--mem-max") == 0 ||
+                   strcmp(token, "--io-max") == 0 || strcmp(token, "--out") == 0 ||
+                   strcmp(token, "--tee") == 0 || strcmp(token, "--pipe-size") == 0) {
+            char *value = argv[++i];
+            if (value == NULL) {
+                printf("Error: %s needs a value\n", token);
+                return 1;
+            }
+            if (strcmp(token, "--cpu-max") == 0) {
+                // cpu.max wants "<quota> <period>"
+                snprintf(opts.cpu_max, sizeof(opts.cpu_max), "%s", value);
+                char *slash = strchr(opts.cpu_max, '/');
+                if (slash != NULL) *slash = ' ';
+            } else if (strcmp(token, "--mem-max") == 0) {
+                snprintf(opts.memory_max, sizeof(opts.memory_max), "%s", value);
+            } else if (strcmp(token, "--io-max") == 0) {
+                // io.max wants "<maj:min> key=value ..."
+                snprintf(opts.io_max, sizeof(opts.io_max), "%s", value);
+                for (char *c = opts.io_max; *c; c++) {
+                    if (*c == ',') *c = ' ';
+                }
+            } else if (strcmp(token, "--out") == 0) {
+                snprintf(opts.out_path, sizeof(opts.out_path), "%s", value);
+            } else if (strcmp(token, "--tee") == 0) {
+                snprintf(opts.tee_path, sizeof(opts.tee_path), "%s", value);
+            } else {
+                opts.pipe_size = atoi(value);
+            }
+        } else if (program == NULL) {
+            program = token;
+        } else if (priority_str == NULL) {
+            priority_str = token;
+        } else {
+            printf("Error: unexpected argument '%s'\n", token);
+            return 1;
+        }
+    }
+
+    if (opts.out_path[0] && opts.tee_path[0]) {
+        printf("Error: --out and --tee cannot be combined\n");
+        return 1;
+    }
+    // The program's argv is the program name followed by everything after --
+    if (job_args != NULL) {
+        job_args[0] = program;
+    } else {
+        static char *no_args[2];
+        no_args[0] = program;
+        no_args[1] = NULL;
+        job_args = no_args;
+    }
+    return handle_submit(job_args, priority_str, &opts) < 0;
+}
+
+int is_operator_char(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+// Finishes the pipeline under construction; returns -1 if it has an empty command
+int finishPipeline(CommandList *list, SimpleCommand *cmd, int connector, int background) {
+    Pipeline *pl = &list->pipelines[list->pipeline_count - 1];
+    if (cmd->argc == 0) return -1;
+    pl->connector = connector;
+    pl->background = background;
+    return 0;
+}
+
+// Copies [start, end) without surrounding blanks; returns the next free byte
+char *copySourceText(char *dest, const char *start, const char *end) {
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    memcpy(dest, start, end - start);
+    dest[end - start] = '\0';
+    return dest + (end - start) + 1;
+}
+
+// Tokenises and parses a whole line in one left-to-right pass into parse_pool.
+// Words are copied (unquoted) into the pool's text buffer, so input is left intact.
+// Returns NULL for an empty line or after reporting a syntax error.
+CommandList *parseCommandLine(const char *input) {
+    ParsePool *pool = &parse_pool;
+    CommandList *list = &pool->list;
+    char *text = pool->text;
+    char **argv = pool->argv;
+    Redirect *redir = pool->redirs;
+    SimpleCommand *cmd = pool->commands;
+    int pending_redir = -1, pending_fd = 0;
+
+    list->pipelines = pool->pipelines;
+    list->pipeline_count = 1;
+    list->pipelines[0] = (Pipeline){ cmd, 1, 0, CONNECT_END, pool->source };
+    *cmd = (SimpleCommand){ argv, 0, redir, 0 };
+    const char *source_start = input;
+    char *source = pool->source;
+
+    const char *p = input;
+    while (1) {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (*p == '\0') break;
+
+        if (is_operator_char(*p) || (isdigit((unsigned char)*p) && (p[1] == '>' || p[1] == '<') &&
+                                      (p == input || isspace((unsigned char)p[-1])))) {
+            int fd = -1;
+            if (isdigit((unsigned char)*p)) fd = *p++ - '0';
+            if (fd > STDERR_FILENO) {
+                printf("SimpleShell: syntax error: only fds 0-2 can be redirected\n");
+                return NULL;
+            }
+
+            if (*p == '<' || *p == '>') {
+                if (pending_redir != -1) goto syntax_error;
+                if (*p == '<') {
+                    pending_redir = REDIR_IN;
+                    pending_fd = fd == -1 ? STDIN_FILENO : fd;
+                    p++;
+                } else {
+                    pending_redir = p[1] == '>' ? REDIR_APPEND : REDIR_OUT;
+                    pending_fd = fd == -1 ? STDOUT_FILENO : fd;
+                    p += p[1] == '>' ? 2 : 1;
+                }
+                continue;
+            }
+
+            if (pending_redir != -1) goto syntax_error;
+            const char *op_start = p;
+            int connector, background = 0;
+            if (*p == '|' && p[1] != '|') {
+                // Next stage of the same pipeline
+                if (cmd->argc == 0) goto syntax_error;
+                *argv++ = NULL;
+                cmd++;
+                *cmd = (SimpleCommand){ argv, 0, redir, 0 };
+                list->pipelines[list->pipeline_count - 1].command_count++;
+                p++;
+                continue;
+            }
+            if (*p == '|') { connector = CONNECT_OR; p += 2; }
+            else if (*p == '&' && p[1] == '&') { connector = CONNECT_AND; p += 2; }
+            else if (*p == '&') { connector = CONNECT_SEQ; background = 1; p++; }
+            else { connector = CONNECT_SEQ; p++; }
+
+            if (finishPipeline(list, cmd, connector, background) == -1) goto syntax_error;
+            list->pipelines[list->pipeline_count - 1].source = source;
+            source = copySourceText(source, source_start, op_start);
+            source_start = p;
+
+            *argv++ = NULL;
+            cmd++;
+            *cmd = (SimpleCommand){ argv, 0, redir, 0 };
+            list->pipelines[list->pipeline_count++] = (Pipeline){ cmd, 1, 0, CONNECT_END, source };
+            continue;
+        }
+
+        // A word: quotes and backslashes are removed as it is copied
+        char *word = text;
+        while (*p != '\0' && !isspace((unsigned char)*p) && !is_operator_char(*p)) {
+            if (*p == '\'' || *p == '"') {
+                char quote = *p++;
+                while (*p != '\0' && *p != quote) {
+                    if (quote == '"' && *p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+                    *text++ = *p++;
+                }
+                if (*p != quote) {
+                    printf("SimpleShell: syntax error: unterminated quote\n");
+                    return NULL;
+                }
+                p++;
+            } else if (*p == '\\' && p[1] != '\0') {
+                p++;
+                *text++ = *p++;
+            } else {
+                *text++ = *p++;
+            }
+        }
+        *text++ = '\0';
+
+        if (pending_redir != -1) {
+            *redir++ = (Redirect){ pending_redir, pending_fd, word };
+            cmd->redir_count++;
+            pending_redir = -1;
+        } else if (cmd->argc == ARGS_MAX - 1) {
+            printf("SimpleShell: syntax error: too many arguments (max %d)\n", ARGS_MAX - 1);
+            return NULL;
+        } else {
+            *argv++ = word;
+            cmd->argc++;
+        }
+    }
+
+    if (pending_redir != -1) goto syntax_error;
+    *argv = NULL;
+
+    Pipeline *last = &list->pipelines[list->pipeline_count - 1];
+    if (cmd->argc == 0) {
+        // A trailing ';' or '&' leaves an empty final pipeline, which is fine
+        if (last->command_count == 1 && cmd->redir_count == 0 && list->pipeline_count > 1 &&
+            list->pipelines[list->pipeline_count - 2].connector == CONNECT_SEQ) {
+            list->pipeline_count--;
+            list->pipelines[list->pipeline_count - 1].connector = CONNECT_END;
+            return list;
+        }
+        if (list->pipeline_count == 1 && last->command_count == 1 && cmd->redir_count == 0) return NULL;
+        goto syntax_error;
+    }
+    last->source = source;
+    copySourceText(source, source_start, source_start + strlen(source_start));
+    return list;
+
+syntax_error:
+    if (*p == '\0') printf("SimpleShell: syntax error near end of line\n");
+    else printf("SimpleShell: syntax error near '%.10s'\n", p);
+    return NULL;
+}
+
+// Drops the older half of a full command log and rebuilds the string store from the
+// entries left, so text for trimmed commands is freed too; job_lock held
+void trimCommandLog() {
+    int drop = history_count / 2;
+    memmove(command_history, command_history + drop, (history_count - drop) * sizeof(CommandLog));
+    history_count -= drop;
+    history_dropped += drop;
+
+    StringStore old = interned;
+    memset(&interned, 0, sizeof(interned));
+    for (int i = 0; i < history_count; i++) {
+        command_history[i].command = intern(command_history[i].command);
+    }
+    interned.lookups = old.lookups;
+    interned.hits = old.hits;
+    free(old.slots);
+    arenaRelease(&old.text, (ArenaMark){ NULL, 0 });
+}
+
+void recordCommand(const char *cmd, pid_t pid, int is_background) {
+    // The reaper walks command_history, so keep it out while the array moves
+    pthread_mutex_lock(&job_lock);
+    if (history_count == COMMAND_LOG_MAX) trimCommandLog();
+    if (history_count == history_capacity) {
+        int capacity = history_capacity ? history_capacity * 2 : 64;
+        if (capacity > COMMAND_LOG_MAX) capacity = COMMAND_LOG_MAX;
+        CommandLog *grown = realloc(command_history, capacity * sizeof(CommandLog));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&job_lock);
+            perror("realloc");
+            return;
+        }
+        command_history = grown;
+        history_capacity = capacity;
+    }
+
+    command_history[history_count].command = intern(cmd);
+    command_history[history_count].pid = pid;
+    command_history[history_count].start_time = time(NULL);
+    command_history[history_count].end_time = 0;
+    command_history[history_count].is_background = is_background;
+    clock_gettime(CLOCK_MONOTONIC, &command_history[history_count].start_mono);
+    memset(&command_history[history_count].end_mono, 0, sizeof(struct timespec));
+    memset(&command_history[history_count].usage, 0, sizeof(struct rusage));
+    history_count++;
+    pthread_mutex_unlock(&job_lock);
+}
+
+void markCommandAsFinished(pid_t pid, const struct rusage *usage) {
+    for (int i = history_count - 1; i >= 0; i--) {
+        if (command_history[i].pid == pid && command_history[i].end_time == 0) {
+            command_history[i].end_time = time(NULL);
+            clock_gettime(CLOCK_MONOTONIC, &command_history[i].end_mono);
+            if (usage != NULL) command_history[i].usage = *usage;
+            break;
+        }
+    }
+}
+
+extern char **environ;
+
+void closeRedirections(int fds[3]);
+
+// Opens a command's redirections into fds[0..2] (-1 = inherit); returns -1 after reporting a failure
+int openRedirections(SimpleCommand *cmd, int fds[3]) {
+    for (int i = 0; i < cmd->redir_count; i++) {
+        Redirect *r = &cmd->redirs[i];
+        int flags = r->type == REDIR_IN ? O_RDONLY
+                  : O_WRONLY | O_CREAT | (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC);
+        int fd = open(r->target, flags | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "SimpleShell: %s: %s\n", r->target, strerror(errno));
+            closeRedirections(fds);
+            return -1;
+        }
+        if (fds[r->fd] > STDERR_FILENO) close(fds[r->fd]);
+        fds[r->fd] = fd;
+    }
+    return 0;
+}
+
+void closeRedirections(int fds[3]) {
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] > STDERR_FILENO) close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+// Launches args with posix_spawn (vfork-style, no page table copy). fds[i], when not -1,
+// becomes the child's fd i; the shell's own descriptors are all O_CLOEXEC.
+// pgid -1 keeps the shell's process group, 0 starts a new one, >0 joins that group.
+// A new foreground group takes the terminal before exec, so a command that reads the
+// tty at once never gets SIGTTIN.
+pid_t spawnCommand(char **args, int fds[3], pid_t pgid, int foreground) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    int take_tty = foreground && pgid == 0 && job_control;
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+    // Ahead of the dup2s, while fd 0 is still the terminal; the child runs this with
+    // signals blocked, so SIGTTOU does not stop it
+    if (take_tty) posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+    take_tty = 0;
+#endif
+#endif
+
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1 && fds[i] != i) posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+    }
+    // Signals the shell ignores for job control must not stay ignored in the child
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if (pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    const char *path = lookup_command(args[0]);
+    if (path == NULL) {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        fprintf(stderr, "SimpleShell: %s: command not found\n", args[0]);
+        return -1;
+    }
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "SimpleShell: %s: %s\n", args[0], strerror(err));
+        return -1;
+    }
+    // Without the spawn action, hand it over as early as the parent can
+    if (take_tty) tcsetpgrp(STDIN_FILENO, pid);
+    return pid;
+}
+
+// Runs a builtin pipeline stage in a forked child so it can read and write the pipes
+pid_t forkBuiltin(const Builtin *b, char **args, int fds[3], pid_t pgid, int foreground) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The parent held job_lock across the fork, and there is no reaper in here
+        pthread_mutex_t unlocked = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+        job_lock = unlocked;
+        setpgid(0, pgid);
+        // Like spawnCommand: a new foreground group takes the terminal itself, while
+        // SIGTTOU is still ignored
+        if (foreground && pgid == 0 && job_control) tcsetpgrp(STDIN_FILENO, getpid());
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        for (int i = 0; i < 3; i++) {
+            if (fds[i] != -1 && fds[i] != i) dup2(fds[i], i);
+        }
+        int status = b->run(args);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    setpgid(pid, pgid == 0 ? pid : pgid);
+    return pid;
+}
+
+int exitStatus(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+// Creates an O_CLOEXEC pipe, applying SIMPLE_SHELL_PIPE_SZ when set
+int makePipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+    char *size = getenv("SIMPLE_SHELL_PIPE_SZ");
+    if (size != NULL && atoi(size) > 0) {
+        fcntl(fds[0], F_SETPIPE_SZ, atoi(size));
+    }
+    return 0;
+}
+
+// Claims a job slot for count stages; the caller holds job_lock from before the first
+// spawn until every pid is added, so the reaper cannot see a child it does not know
+Job *startJob(const char *command, int count, int background) {
+    for (int i = 0; i < JOB_TABLE_MAX; i++) {
+        Job *j = &shell_jobs[i];
+        if (j->used) continue;
+        pid_t *pids = j->pids;
+        int *status = j->status;
+        int capacity = j->capacity;
+        char *text = j->command;
+        size_t text_cap = j->command_cap;
+        size_t len = strlen(command) + 1;
+        if (text_cap < len) {
+            text_cap = len < 256 ? 256 : len;
+            free(text);
+            text = malloc(text_cap);
+        }
+        if (capacity < count) {
+            capacity = count < 8 ? 8 : count;
+            free(pids);
+            free(status);
+            pids = malloc(capacity * sizeof(pid_t));
+            status = malloc(capacity * sizeof(int));
+        }
+        memset(j, 0, sizeof(*j));
+        j->used = 1;
+        j->id = i + 1;
+        j->seq = ++job_seq;
+        j->pids = pids;
+        j->status = status;
+        j->capacity = capacity;
+        j->count = count;
+        j->state = JOB_RUNNING;
+        j->background = background;
+        j->command = memcpy(text, command, len);
+        j->command_cap = text_cap;
+        for (int k = 0; k < count; k++) {
+            j->pids[k] = 0;
+            j->status[k] = 127 << 8;  // stages that never start report 127
+        }
+        return j;
+    }
+    fprintf(stderr, "SimpleShell: too many jobs\n");
+    return NULL;
+}
+
+void addJobProcess(Job *j, int stage, pid_t pid) {
+    j->pids[stage] = pid;
+    j->live++;
+    if (j->pgid == 0) j->pgid = pid;
+}
+
+// Called once every stage has been spawned (job_lock still held)
+void launchedJob(Job *j) {
+    if (j->live == 0) {
+        j->state = JOB_DONE;
+        if (j->background) j->used = 0;
+        return;
+    }
+    // The log only feeds the exit summary, which batch runs do not print
+    if (interactive) recordCommand(j->command, j->pgid, j->background);
+    if (j->background) printf("[%d] %d\n", j->id, j->pgid);
+}
+
+// Gives j the terminal and blocks until it finishes or stops; returns the last stage's status
+int waitForJob(Job *j) {
+    if (job_control && j->state != JOB_DONE) {
+        if (j->have_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &j->tmodes);
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+
+    pthread_mutex_lock(&job_lock);
+    int forwarded = 0;
+    while (j->state == JOB_RUNNING) {
+        // Without a terminal to route Ctrl-C, pass our own SIGINT on to the job
+        if (received_sigint && !forwarded && !job_control) {
+            kill(-j->pgid, SIGINT);
+            forwarded = 1;
+        }
+        pthread_cond_wait(&job_changed, &job_lock);
+    }
+
+    int status;
+    if (j->state == JOB_STOPPED) {
+        j->background = 1;
+        printf("\n[%d] Stopped    %s\n", j->id, j->command);
+        status = 128 + SIGTSTP;
+    } else {
+        status = exitStatus(j->status[j->count - 1]);
+        if (WIFSIGNALED(j->status[j->count - 1]) && WTERMSIG(j->status[j->count - 1]) == SIGINT) {
+            line_interrupted = 1;
+        }
+        if (status == 128 + SIGINT && job_control) printf("\n");
+        last_job_usage = j->usage;
+        last_job_usage_valid = 1;
+        if (j->count > 1) {
+            if (j->count > pipeline_status_capacity) {
+                free(pipeline_status);
+                pipeline_status = malloc(j->count * sizeof(int));
+                pipeline_status_capacity = j->count;
+            }
+            pipeline_status_count = j->count;
+            for (int i = 0; i < j->count; i++) {
+                pipeline_status[i] = exitStatus(j->status[i]);
+            }
+        }
+        j->used = 0;
+    }
+    pthread_mutex_unlock(&job_lock);
+
+    if (job_control) {
+        if (j->state == JOB_STOPPED) {
+            j->have_tmodes = tcgetattr(STDIN_FILENO, &j->tmodes) == 0;
+        }
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+    return status;
+}
+
+int executeCommand(SimpleCommand *cmd, int is_background) {
+    int fds[3] = { -1, -1, -1 };
+
+    if (openRedirections(cmd, fds) == -1) return 1;
+    pthread_mutex_lock(&job_lock);
+    Job *j = startJob(cmd->argv[0], 1, is_background);
+    pid_t pid = -1;
+    if (j != NULL) {
+        pid = spawnCommand(cmd->argv, fds, 0, !is_background);
+        if (pid > 0) addJobProcess(j, 0, pid);
+        launchedJob(j);
+        if (pid < 0) j->used = 0;
+    }
+    pthread_mutex_unlock(&job_lock);
+    closeRedirections(fds);
+    if (pid < 0) return 127;
+
+    return is_background ? 0 : waitForJob(j);
+}
+
+// Spawns every stage straight from the shell into one process group, holding only
+// the pipe between neighbouring stages open; the reaper collects each stage's status
+int handlePipedCommands(Pipeline *pl) {
+    for (int i = 0; i < pl->command_count; i++) {
+        const char *name = pl->commands[i].argv[0];
+        if (strcmp(name, "submit") == 0 || strcmp(name, "parallel") == 0 || strcmp(name, "submit-dag") == 0) {
+            printf("Error: Pipes are not allowed with %s command\n", name);
+            return 1;
+        }
+    }
+
+    int command_count = pl->command_count;
+    int prev_read = -1;
+
+    // `cat file | cmd` gives cmd the file itself as stdin: no cat stage, no pipe to copy
+    // through. Only for regular files, opened before job_lock and without blocking, so a
+    // FIFO with no writer cannot hang the shell; anything else keeps a real cat stage.
+    int first = 0;
+    SimpleCommand *head = &pl->commands[0];
+    if (strcmp(head->argv[0], "cat") == 0 && head->argc == 2 && head->redir_count == 0 &&
+        head->argv[1][0] != '-') {
+        struct stat st;
+        prev_read = open(head->argv[1], O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if (prev_read != -1 && fstat(prev_read, &st) == 0 && S_ISREG(st.st_mode) &&
+            fcntl(prev_read, F_SETFL, 0) == 0) {
+            first = 1;
+        } else if (prev_read != -1) {
+            // Let the forked cat handle it, or report the error as usual
+            close(prev_read);
+            prev_read = -1;
+        }
+    }
+
+    pthread_mutex_lock(&job_lock);
+    Job *j = startJob(pl->source, command_count, pl->background);
+    if (j == NULL) {
+        pthread_mutex_unlock(&job_lock);
+        if (prev_read != -1) close(prev_read);
+        return 1;
+    }
+    if (first) j->status[0] = 0;
+
+    for (int i = first; i < command_count; i++) {
+        int next[2] = { -1, -1 };
+        if (i < command_count - 1 && makePipe(next) == -1) {
+            perror("Pipe creation failed");
+            break;
+        }
+
+        int fds[3] = { prev_read, next[1], -1 };
+        // Redirections take precedence over the pipe, as in sh
+        int redir_fds[3] = { -1, -1, -1 };
+        if (openRedirections(&pl->commands[i], redir_fds) == 0) {
+            for (int k = 0; k < 3; k++) {
+                if (redir_fds[k] != -1) fds[k] = redir_fds[k];
+            }
+            const Builtin *b = findBuiltin(pl->commands[i].argv[0]);
+            pid_t pid = b != NULL ? forkBuiltin(b, pl->commands[i].argv, fds, j->pgid, !pl->background)
+                                  : spawnCommand(pl->commands[i].argv, fds, j->pgid, !pl->background);
+            if (pid > 0) addJobProcess(j, i, pid);
+            closeRedirections(redir_fds);
+        }
+
+        if (prev_read != -1) close(prev_read);
+        if (next[1] != -1) close(next[1]);
+        prev_read = next[0];
+    }
+    if (prev_read != -1) close(prev_read);
+
+    launchedJob(j);
+    pthread_mutex_unlock(&job_lock);
+
+    return pl->background ? 0 : waitForJob(j);
+}
+
+// pipestatus: exit status of every stage of the last foreground pipeline
+int showPipelineStatus(char **args) {
+    for (int i = 0; i < pipeline_status_count; i++) {
+        printf("%s%d", i ? " " : "", pipeline_status[i]);
+    }
+    printf("\n");
+    return 0;
+}
+
+// cd [dir | -]
+int handle_cd(char **args) {
+    const char *dir = args[1];
+    if (dir == NULL) {
+        dir = getenv("HOME");
+        if (dir == NULL) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    } else if (strcmp(dir, "-") == 0) {
+        dir = getenv("OLDPWD");
+        if (dir == NULL) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        printf("%s\n", dir);
+    }
+
+    char old[PATH_MAX];
+    if (getcwd(old, sizeof(old)) == NULL) old[0] = '\0';
+    if (chdir(dir) == -1) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (old[0] != '\0') setenv("OLDPWD", old, 1);
+    if (getcwd(cwd, sizeof(cwd)) != NULL) setenv("PWD", cwd, 1);
+    return 0;
+}
+
+int handle_pwd(char **args) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+// echo [-n] args...
+int handle_echo(char **args) {
+    int i = 1;
+    int newline = 1;
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    for (int first = i; args[i] != NULL; i++) {
+        printf("%s%s", i > first ? " " : "", args[i]);
+    }
+    if (newline) printf("\n");
+    return 0;
+}
+
+// export [NAME=VALUE | NAME]...; with no arguments lists the environment
+int handle_export(char **args) {
+    if (args[1] == NULL) {
+        for (char **e = environ; *e != NULL; e++) {
+            printf("export %s\n", *e);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        char *eq = strchr(args[i], '=');
+        size_t len = eq != NULL ? (size_t)(eq - args[i]) : strlen(args[i]);
+        char name[256];
+        if (len == 0 || len >= sizeof(name)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        memcpy(name, args[i], len);
+        name[len] = '\0';
+        // A bare NAME exports an empty value unless it is already set
+        if (eq != NULL) {
+            setenv(name, eq + 1, 1);
+        } else if (getenv(name) == NULL) {
+            setenv(name, "", 1);
+        }
+    }
+    return status;
+}
+
+// jobs: stopped and background jobs, then scheduler jobs still pending
+int handle_jobs(char **args) {
+    pthread_mutex_lock(&job_lock);
+    for (int i = 0; i < JOB_TABLE_MAX; i++) {
+        Job *j = &shell_jobs[i];
+        if (j->used && j->state != JOB_DONE) {
+            printf("[%d] %-10s %s\n", j->id, jobStateName(j), j->command);
+        }
+    }
+    for (int i = 0; i < job_count; i++) {
+        if (!scheduler_jobs[i].completed) {
+            printf("[%d] Scheduled  %s (priority %d)\n", scheduler_jobs[i].pid,
+                   scheduler_jobs[i].name, scheduler_jobs[i].priority);
+        }
+    }
+    pthread_mutex_unlock(&job_lock);
+    return 0;
+}
+
+// Parses a positive decimal pid; returns -1 for anything else, including trailing junk
+pid_t parsePid(const char *s) {
+    char *end;
+    errno = 0;
+    long pid = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || pid <= 0 || pid != (pid_t)pid) return -1;
+    return pid;
+}
+
+// Resolves %n, a job's pid, or (with no spec) the newest unfinished job; job_lock held
+Job *findJob(const char *spec) {
+    Job *best = NULL;
+    for (int i = 0; i < JOB_TABLE_MAX; i++) {
+        Job *j = &shell_jobs[i];
+        if (!j->used || j->state == JOB_DONE) continue;
+        if (spec == NULL) {
+            if (best == NULL || j->seq > best->seq) best = j;
+        } else if (spec[0] == '%') {
+            if (j->id == atoi(spec + 1)) return j;
+        } else {
+            pid_t pid = parsePid(spec);
+            if (pid == -1) return NULL;
+            if (j->pgid == pid) return j;
+            for (int k = 0; k < j->count; k++) {
+                if (j->pids[k] == pid) return j;
+            }
+        }
+    }
+    return best;
+}
+
+// fg [%n | pid]
+int handle_fg(char **args) {
+    pthread_mutex_lock(&job_lock);
+    Job *j = findJob(args[1]);
+    if (j == NULL) {
+        pthread_mutex_unlock(&job_lock);
+        fprintf(stderr, "fg: %s: no such job\n", args[1] != NULL ? args[1] : "current");
+        return 1;
+    }
+    printf("%s\n", j->command);
+    j->background = 0;
+    j->state = JOB_RUNNING;
+    pthread_mutex_unlock(&job_lock);
+
+    if (job_control) {
+        if (j->have_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &j->tmodes);
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+    kill(-j->pgid, SIGCONT);
+    return waitForJob(j);
+}
+
+// bg [%n | pid]
+int handle_bg(char **args) {
+    pthread_mutex_lock(&job_lock);
+    Job *j = findJob(args[1]);
+    if (j == NULL || j->state != JOB_STOPPED) {
+        pthread_mutex_unlock(&job_lock);
+        fprintf(stderr, "bg: %s: no stopped job\n", args[1] != NULL ? args[1] : "current");
+        return 1;
+    }
+    j->background = 1;
+    j->state = JOB_RUNNING;
+    printf("[%d] %s &\n", j->id, j->command);
+    kill(-j->pgid, SIGCONT);
+    pthread_mutex_unlock(&job_lock);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int sig;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM }, { "CONT", SIGCONT },
+    { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+};
+
+int parse_signal(const char *str) {
+    if (isdigit((unsigned char)str[0])) return atoi(str);
+    if (strncmp(str, "SIG", 3) == 0) str += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++) {
+        if (strcmp(str, signal_names[i].name) == 0) return signal_names[i].sig;
+    }
+    return -1;
+}
+
+// kill [-SIG | -N] pid...
+int handle_kill(char **args) {
+    int sig = SIGTERM;
+    int i = 1;
+    if (args[1] != NULL && args[1][0] == '-') {
+        sig = parse_signal(args[1] + 1);
+        if (sig < 0) {
+            fprintf(stderr, "kill: %s: invalid signal\n", args[1] + 1);
+            return 1;
+        }
+        i++;
+    }
+    if (args[i] == NULL) {
+        printf("Usage: kill [-SIG] pid...\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (; args[i] != NULL; i++) {
+        // %n signals the job's whole process group
+        pid_t target;
+        if (args[i][0] != '%') {
+            target = parsePid(args[i]);
+            if (target == -1) {
+                fprintf(stderr, "kill: %s: arguments must be process or job IDs\n", args[i]);
+                status = 1;
+                continue;
+            }
+        } else {
+            pthread_mutex_lock(&job_lock);
+            Job *j = findJob(args[i]);
+            target = j != NULL ? -j->pgid : 0;
+            pthread_mutex_unlock(&job_lock);
+            if (target == 0) {
+                fprintf(stderr, "kill: %s: no such job\n", args[i]);
+                status = 1;
+                continue;
+            }
+        }
+        if (kill(target, sig) == -1) {
+            fprintf(stderr, "kill: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Waits until a job finishes; job_lock held. Stopping does not end the wait, as in sh.
+int waitJobDone(Job *j) {
+    while (j->state != JOB_DONE && !received_sigint) {
+        pthread_cond_wait(&job_changed, &job_lock);
+    }
+    return j->state == JOB_DONE ? exitStatus(j->status[j->count - 1]) : 128 + SIGINT;
+}
+
+// wait [%n | pid...]; with no arguments waits for every background job
+int handle_wait(char **args) {
+    int status = 0;
+    pthread_mutex_lock(&job_lock);
+    if (args[1] == NULL) {
+        for (int i = 0; i < JOB_TABLE_MAX; i++) {
+            if (shell_jobs[i].used && shell_jobs[i].background) {
+                status = waitJobDone(&shell_jobs[i]);
+            }
+        }
+        // Scripts rely on this to let submitted jobs finish before exiting
+        for (int i = 0; i < job_count; i++) {
+            while (!scheduler_jobs[i].completed && !received_sigint) {
+                pthread_cond_wait(&job_changed, &job_lock);
+            }
+        }
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        Job *j = findJob(args[i]);
+        if (j != NULL) {
+            status = waitJobDone(j);
+            continue;
+        }
+        // Submitted jobs are children too, but the scheduler runs them
+        pid_t pid = args[i][0] == '%' ? -1 : parsePid(args[i]);
+        int k = 0;
+        while (pid != -1 && k < job_count && scheduler_jobs[k].pid != pid) k++;
+        if (pid == -1 || k == job_count) {
+            // Like sh, a pid that is not our child is 127
+            if (pid == -1) fprintf(stderr, "wait: %s: not a pid or valid job spec\n", args[i]);
+            else fprintf(stderr, "wait: pid %d is not a child of this shell\n", pid);
+            status = 127;
+            continue;
+        }
+        while (!scheduler_jobs[k].completed && !received_sigint) {
+            pthread_cond_wait(&job_changed, &job_lock);
+        }
+        status = scheduler_jobs[k].completed ? scheduler_jobs[k].exit_status : 128 + SIGINT;
+    }
+    pthread_mutex_unlock(&job_lock);
+    if (received_sigint && job_control) received_sigint = 0;
+    return status;
+}
+
+// exit [status]
+int handle_exit(char **args) {
+    exit_requested = 1;
+    exit_code = args[1] != NULL ? atoi(args[1]) : 0;
+    return exit_code;
+}
+
+// memstats: allocation counts for the line arena and the interned strings, plus heap in use
+int handle_memstats(char **args) {
+    struct mallinfo2 mi = mallinfo2();
+    printf("Line arena:   %lu allocations in %lu chunk mallocs, %lu resets, %zu KB held, peak %zu KB\n",
+           line_arena.allocs, line_arena.chunk_allocs, line_arena.resets,
+           line_arena.reserved / 1024, line_arena.peak / 1024);
+    printf("Interned:     %zu strings, %zu KB text, %lu lookups (%lu hits)\n",
+           interned.count, interned.bytes / 1024, interned.lookups, interned.hits);
+    printf("Command log:  %d entries (%zu KB), %d older trimmed\n",
+           history_count, (size_t)history_capacity * sizeof(CommandLog) / 1024, history_dropped);
+    printf("Heap:         %zu KB in use, %zu KB mmapped\n", mi.uordblks / 1024, mi.hblkhd / 1024);
+    return 0;
+}
+
+// Ways copyFd can move bytes, tried in this order until the pair of files accepts one
+enum {
+    COPY_RANGE,     // copy_file_range: file to file, in the filesystem (reflinks where supported)
+    COPY_SPLICE,    // splice: either end is a pipe
+    COPY_SENDFILE,  // sendfile: a file to a socket, terminal or anything else
+    COPY_READ       // read/write through a buffer
+};
+
+// Copies in to out until EOF without passing through user space when the kernel allows;
+// returns 0, or -1 with errno set
+int copyFd(int in, int out) {
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) == -1 || fstat(out, &out_st) == -1) return -1;
+
+    // Pseudo-files report size 0 but still have contents, so leave them to read()
+    int method = COPY_READ;
+    if (S_ISREG(in_st.st_mode) && in_st.st_size > 0 && S_ISREG(out_st.st_mode)) method = COPY_RANGE;
+    else if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) method = COPY_SPLICE;
+    else if (S_ISREG(in_st.st_mode) && in_st.st_size > 0) method = COPY_SENDFILE;
+
+    static char buffer[65536];
+    while (!received_sigint) {
+        ssize_t n;
+        if (method == COPY_RANGE) n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        else if (method == COPY_SPLICE) n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+        else if (method == COPY_SENDFILE) n = sendfile(out, in, NULL, COPY_CHUNK);
+        else {
+            n = read(in, buffer, sizeof(buffer));
+            for (ssize_t off = 0; n > 0 && off < n; ) {
+                ssize_t w = write(out, buffer + off, n - off);
+                if (w < 0 && errno == EINTR && !received_sigint) continue;
+                if (w <= 0) return -1;
+                off += w;
+            }
+        }
+        if (n == 0) return 0;
+        if (n > 0 || errno == EINTR) continue;
+
+        // Refused for this pair (another filesystem, O_APPEND, a tty): step down a method.
+        // All of them advance the file offsets, so nothing is copied twice.
+        if (method == COPY_READ || (errno != EINVAL && errno != EXDEV && errno != ENOSYS &&
+                                    errno != EOPNOTSUPP && errno != EBADF)) {
+            return -1;
+        }
+        method = method != COPY_SENDFILE && S_ISREG(in_st.st_mode) && in_st.st_size > 0
+                 ? COPY_SENDFILE : COPY_READ;
+    }
+    errno = EINTR;
+    return -1;
+}
+
+// True when in and out are the same regular file, which cat would chase forever
+int sameFile(int in, int out) {
+    struct stat a, b;
+    return fstat(in, &a) == 0 && fstat(out, &b) == 0 && S_ISREG(a.st_mode) &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// cat [file | -]...
+int handle_cat(char **args) {
+    char *stdin_only[] = { args[0], "-", NULL };
+    if (args[1] == NULL) args = stdin_only;
+
+    // Ctrl-C has to interrupt a read or write blocked in here, not restart it
+    struct sigaction sa, old_sa;
+    sigaction(SIGINT, NULL, &old_sa);
+    sa = old_sa;
+    sa.sa_flags &= ~SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+
+    int status = 0;
+    fflush(stdout);
+    for (int i = 1; args[i] != NULL && !received_sigint; i++) {
+        int fd = strcmp(args[i], "-") == 0 ? STDIN_FILENO : open(args[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (sameFile(fd, STDOUT_FILENO)) {
+            fprintf(stderr, "cat: %s: input file is output file\n", args[i]);
+            status = 1;
+        } else if (copyFd(fd, STDOUT_FILENO) == -1 && errno != EINTR) {
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    sigaction(SIGINT, &old_sa, NULL);
+
+    if (received_sigint) {
+        if (job_control) received_sigint = 0;
+        line_interrupted = 1;
+        return 128 + SIGINT;
+    }
+    return status;
+}
+
+// Whether cat would read a terminal, pipe, FIFO or other non-file, where it can block
+// until someone types or a writer shows up. Those run as a forked /bin/cat that gets
+// the terminal, so Ctrl-C kills it like any other foreground command.
+int catMayBlock(SimpleCommand *cmd) {
+    struct stat st;
+    int reads_stdin = cmd->argc == 1;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->argv[i], "-") == 0) reads_stdin = 1;
+        else if (stat(cmd->argv[i], &st) == 0 && !S_ISREG(st.st_mode)) return 1;
+    }
+    if (!reads_stdin) return 0;
+
+    const char *stdin_path = NULL;
+    for (int i = 0; i < cmd->redir_count; i++) {
+        if (cmd->redirs[i].fd == STDIN_FILENO) stdin_path = cmd->redirs[i].target;
+    }
+    int found = stdin_path != NULL ? stat(stdin_path, &st) : fstat(STDIN_FILENO, &st);
+    return found == 0 && !S_ISREG(st.st_mode);
+}
+
+// Copies one file; dest is created with the source's permission bits
+int copyFile(const char *src, const char *dest) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        fprintf(stderr, "cp: %s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(in, &st) == 0 && S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "cp: %s: Is a directory\n", src);
+        close(in);
+        return 1;
+    }
+    // Check before O_TRUNC, which would empty the source
+    struct stat dest_st;
+    if (stat(dest, &dest_st) == 0 && dest_st.st_dev == st.st_dev && dest_st.st_ino == st.st_ino) {
+        fprintf(stderr, "cp: %s and %s are the same file\n", src, dest);
+        close(in);
+        return 1;
+    }
+
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (out == -1) {
+        fprintf(stderr, "cp: %s: %s\n", dest, strerror(errno));
+        close(in);
+        return 1;
+    }
+    int status = 0;
+    if (copyFd(in, out) == -1) {
+        if (errno != EINTR) fprintf(stderr, "cp: %s: %s\n", dest, strerror(errno));
+        status = 1;
+    }
+    close(in);
+    if (close(out) == -1 && status == 0) {
+        fprintf(stderr, "cp: %s: %s\n", dest, strerror(errno));
+        status = 1;
+    }
+    return status;
+}
+
+// cp src dest | cp src... dir
+int handle_cp(char **args) {
+    int count = 0;
+    while (args[count + 1] != NULL) count++;
+    if (count < 2) {
+        printf("Usage: cp src dest | cp src... dir\n");
+        return 1;
+    }
+
+    const char *target = args[count];
+    struct stat st;
+    int to_dir = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+    if (count > 2 && !to_dir) {
+        fprintf(stderr, "cp: %s: Not a directory\n", target);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; i < count && !received_sigint; i++) {
+        if (!to_dir) {
+            status |= copyFile(args[i], target);
+            continue;
+        }
+        const char *base = strrchr(args[i], '/');
+        base = base != NULL ? base + 1 : args[i];
+        char dest[PATH_MAX];
+        snprintf(dest, sizeof(dest), "%s/%s", target, base);
+        status |= copyFile(args[i], dest);
+    }
+
+    if (received_sigint) {
+        if (job_control) received_sigint = 0;
+        return 128 + SIGINT;
+    }
+    return status;
+}
+
+int showCommandHistory(char **args);
+int handle_output(char **args);
+int handle_parallel(char **args);
+int handle_submit_dag(char **args);
+
+const Builtin builtins[] = {
+    { "cd", handle_cd },
+    { "pwd", handle_pwd },
+    { "echo", handle_echo },
+    { "cat", handle_cat },
+    { "cp", handle_cp },
+    { "export", handle_export },
+    { "jobs", handle_jobs },
+    { "kill", handle_kill },
+    { "wait", handle_wait },
+    { "fg", handle_fg },
+    { "bg", handle_bg },
+    { "exit", handle_exit },
+    { "history", showCommandHistory },
+    { "submit", parse_submit },
+    { "parallel", handle_parallel },
+    { "submit-dag", handle_submit_dag },
+    { "output", handle_output },
+    { "hash", handle_hash },
+    { "pipestatus", showPipelineStatus },
+    { "memstats", handle_memstats },
+};
+
+const Builtin *findBuiltin(const char *name) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(name, builtins[i].name) == 0) return &builtins[i];
+    }
+    return NULL;
+}
 
-        printf("Submitted job: %s with PID: %d, Priority: %d\n", program, pid, priority);
+// Runs a builtin in the shell itself, pointing fds 0-2 at its redirections for the duration
+int runBuiltin(const Builtin *b, SimpleCommand *cmd) {
+    int fds[3] = { -1, -1, -1 };
+    int saved[3] = { -1, -1, -1 };
+
+    if (openRedirections(cmd, fds) == -1) return 1;
+    fflush(stdout);
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == -1) continue;
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        dup2(fds[i], i);
+    }
 
-        
-        pthread_t output_thread;
-        int *pipe_fd = malloc(sizeof(int));
-        *pipe_fd = output_pipe[0];
-        pthread_create(&output_thread, NULL, output_handler, pipe_fd);
-        pthread_detach(output_thread);
+    int status = b->run(cmd->argv);
 
-       
-        scheduler_jobs[job_count].pid = pid;
-        strncpy(scheduler_jobs[job_count].name, program, sizeof(scheduler_jobs[job_count].name) - 1);
-        scheduler_jobs[job_count].priority = priority;
-        scheduler_jobs[job_count].start_time = time(NULL);
-        scheduler_jobs[job_count].completed = 0;
-        scheduler_jobs[job_count].slices_run = 0;
-        job_count++;
-    } else {
-        perror("Fork failed");
-        close(output_pipe[0]);
-        close(output_pipe[1]);
+    fflush(stdout);
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] == -1) continue;
+        dup2(saved[i], i);
+        close(saved[i]);
     }
+    closeRedirections(fds);
+    return status;
+}
 
-    free(path);
+void printUsage(const char *command, double wall, const struct rusage *ru) {
+    fprintf(stderr, "%s%sreal %.3fs  user %.3fs  sys %.3fs  maxrss %ldKB  faults %ld/%ld  csw %ld/%ld\n",
+            command != NULL ? command : "", command != NULL ? ": " : "",
+            wall, tvSeconds(&ru->ru_utime), tvSeconds(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
 }
 
+int runPipelineStages(Pipeline *pl) {
+    SimpleCommand *cmd = &pl->commands[0];
+    if (pl->command_count > 1) {
+        return handlePipedCommands(pl);
+    }
+
+    const Builtin *b = findBuiltin(cmd->argv[0]);
+    if (b != NULL && !(b->run == handle_cat && catMayBlock(cmd))) {
+        return runBuiltin(b, cmd);
+    }
+    return executeCommand(cmd, pl->background);
+}
 
+// A leading "time" reports the pipeline's wall clock and its processes' rusage on
+// stderr; SIMPLE_SHELL_TIMING does the same for every foreground pipeline
+int runPipeline(Pipeline *pl) {
+    SimpleCommand *cmd = &pl->commands[0];
+    int timed = strcmp(cmd->argv[0], "time") == 0;
+    if (timed) {
+        cmd->argv++;
+        cmd->argc--;
+    }
+    timed = (timed || getenv("SIMPLE_SHELL_TIMING") != NULL) && !pl->background;
+    if (cmd->argv[0] == NULL) {
+        struct rusage none;
+        memset(&none, 0, sizeof(none));
+        if (timed) printUsage(NULL, 0, &none);
+        return 0;
+    }
+    if (!timed) return runPipelineStages(pl);
 
-void removeLeadingTrailingSpaces(char *str) {
+    // Builtins run in the shell, so they are measured as the shell's own usage
+    struct timespec start, end;
+    struct rusage self_before, self_after;
+    getrusage(RUSAGE_SELF, &self_before);
+    last_job_usage_valid = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    char *end;
-    while(isspace((unsigned char)*str)) str++;
-    if(*str == 0) return;
-    end = str + strlen(str) - 1;
-    while(end > str && isspace((unsigned char)*end)) end--;
-    end[1] = '\0';
+    int status = runPipelineStages(pl);
 
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (last_job_usage_valid) {
+        self_after = last_job_usage;
+    } else {
+        getrusage(RUSAGE_SELF, &self_after);
+        subUsage(&self_after, &self_before);
+    }
+    fflush(stdout);
+    printUsage(getenv("SIMPLE_SHELL_TIMING") != NULL ? pl->source : NULL,
+               elapsedSeconds(&start, &end), &self_after);
+    return status;
 }
 
-int splitCommandIntoArgs(char *input, char **args) {
-    char *token;
-    int index = 0;
-    int is_background = 0;
-
-    token = strtok(input, " \n");
-    while (token != NULL && index < ARGS_MAX - 1) {
-        if (strcmp(token, "&") == 0) {
-            is_background = 1;
-            break;
+// Runs each pipeline in turn, honouring && and || against the last exit status
+int executeCommandList(CommandList *list) {
+    int status = 0;
+    int connector = CONNECT_SEQ;
+    line_interrupted = 0;
+    for (int i = 0; i < list->pipeline_count && !line_interrupted; i++) {
+        Pipeline *pl = &list->pipelines[i];
+        int skip = (connector == CONNECT_AND && status != 0) || (connector == CONNECT_OR && status == 0);
+        if (!skip) {
+            status = runPipeline(pl);
         }
-        args[index++] = token;
-        token = strtok(NULL, " \n");
+        connector = pl->connector;
     }
-    args[index] = NULL;
-    return is_background;
+    return status;
 }
 
-void recordCommand(char *cmd, pid_t pid, int is_background) {
+// Maps the history file up to its current size
+int history_map(size_t size) {
+    if (size <= hist.map_size) return 0;
+    char *map = hist.map == NULL
+        ? mmap(NULL, size, PROT_READ, MAP_SHARED, hist.fd, 0)
+        : mremap(hist.map, hist.map_size, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        perror("history mmap");
+        return -1;
+    }
+    hist.map = map;
+    hist.map_size = size;
+    return 0;
+}
 
-    if (history_count < HISTORY_MAX) {
-        command_history[history_count].command = strdup(cmd);
-        command_history[history_count].pid = pid;
-        command_history[history_count].start_time = time(NULL);
-        command_history[history_count].end_time = 0;
-        command_history[history_count].is_background = is_background;
-        history_count++;
+void history_push(unsigned long long offset) {
+    if (hist.count == hist.capacity) {
+        size_t capacity = hist.capacity ? hist.capacity * 2 : 1024;
+        unsigned long long *grown = realloc(hist.offsets, capacity * sizeof(*grown));
+        if (grown == NULL) return;
+        hist.offsets = grown;
+        hist.capacity = capacity;
     }
+    hist.offsets[hist.count++] = offset;
+}
 
+// Picks up complete lines appended since the last scan, by this shell or another one
+void history_scan() {
+    struct stat st;
+    if (hist.fd < 0 || fstat(hist.fd, &st) == -1) return;
+    if ((size_t)st.st_size <= hist.scanned || history_map(st.st_size) == -1) return;
+
+    size_t start = hist.scanned;
+    const char *nl;
+    while ((nl = memchr(hist.map + start, '\n', hist.map_size - start)) != NULL) {
+        history_push(start);
+        start = nl - hist.map + 1;
+    }
+    hist.scanned = start;
 }
 
-void markCommandAsFinished(pid_t pid) {
-    for (int i = history_count - 1; i >= 0; i--) {
-        if (command_history[i].pid == pid && command_history[i].end_time == 0) {
-            command_history[i].end_time = time(NULL);
-            break;
+// Writes offsets the index file does not have yet; entries are the same in every
+// shell sharing the file, so concurrent writers only ever agree
+void history_save_index() {
+    if (hist.index_fd < 0) return;
+    flock(hist.index_fd, LOCK_EX);
+    HistoryIndexHeader hdr;
+    if (pread(hist.index_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        hdr.magic == HISTORY_INDEX_MAGIC && hdr.count > hist.count) {
+        // Another shell has indexed further already
+        hist.indexed = hist.count;
+    }
+    if (hist.count > hist.indexed) {
+        size_t bytes = (hist.count - hist.indexed) * sizeof(*hist.offsets);
+        off_t at = sizeof(hdr) + hist.indexed * sizeof(*hist.offsets);
+        if (pwrite(hist.index_fd, hist.offsets + hist.indexed, bytes, at) == (ssize_t)bytes) {
+            hdr.magic = HISTORY_INDEX_MAGIC;
+            hdr.pad = 0;
+            hdr.covered = hist.scanned;
+            hdr.count = hist.count;
+            pwrite(hist.index_fd, &hdr, sizeof(hdr), 0);
+            hist.indexed = hist.count;
         }
     }
+    flock(hist.index_fd, LOCK_UN);
 }
 
-int executeCommand(char **args, int is_background) {
-    pid_t pid;
-    int status;
-
-    pid = fork();
-    if (pid == 0) {
-        if (execvp(args[0], args) == -1) {
-            perror("SimpleShell");
-        }
-        exit(EXIT_FAILURE);
-    } else if (pid < 0) {
-        perror("SimpleShell");
+// Opens $SIMPLE_SHELL_HISTFILE (default ~/.simple_shell_history) and loads its index
+void history_open() {
+    char path[PATH_MAX], index_path[PATH_MAX + 8];
+    const char *env = getenv("SIMPLE_SHELL_HISTFILE");
+    if (env != NULL) {
+        snprintf(path, sizeof(path), "%s", env);
+    } else if (getenv("HOME") != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", getenv("HOME"), HISTORY_FILE);
     } else {
-        recordCommand(args[0], pid, is_background);
-        if (!is_background) {
-            do {
-                waitpid(pid, &status, WUNTRACED);
-            } while (!WIFEXITED(status) && !WIFSIGNALED(status));
-            markCommandAsFinished(pid);
-        } else {
-            printf("[%d] %s\n", pid, args[0]);
+        return;
+    }
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+    hist.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (hist.fd < 0) {
+        fprintf(stderr, "SimpleShell: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    hist.index_fd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    struct stat st, ist;
+    fstat(hist.fd, &st);
+    if (st.st_size > 0 && history_map(st.st_size) == -1) return;
+
+    // Trust the index only if it still lines up with the file
+    HistoryIndexHeader hdr;
+    if (hist.index_fd >= 0) flock(hist.index_fd, LOCK_SH);
+    if (hist.index_fd >= 0 && fstat(hist.index_fd, &ist) == 0 &&
+        pread(hist.index_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        hdr.magic == HISTORY_INDEX_MAGIC && hdr.covered <= (unsigned long long)st.st_size &&
+        (hdr.covered == 0 || hist.map[hdr.covered - 1] == '\n') &&
+        (unsigned long long)ist.st_size >= sizeof(hdr) + hdr.count * sizeof(*hist.offsets)) {
+        hist.capacity = hdr.count + 1024;
+        hist.offsets = malloc(hist.capacity * sizeof(*hist.offsets));
+        size_t bytes = hdr.count * sizeof(*hist.offsets);
+        if (hist.offsets != NULL &&
+            pread(hist.index_fd, hist.offsets, bytes, sizeof(hdr)) == (ssize_t)bytes &&
+            (hdr.count == 0 || hist.offsets[hdr.count - 1] < hdr.covered)) {
+            hist.count = hist.indexed = hdr.count;
+            hist.scanned = hdr.covered;
         }
     }
+    if (hist.index_fd >= 0) flock(hist.index_fd, LOCK_UN);
 
-    return 1;
+    if (hist.count == 0 && hist.index_fd >= 0) {
+        ftruncate(hist.index_fd, 0);
+    }
+    history_scan();
+    history_save_index();
 }
 
-void handlePipedCommands(char *input) {
-    
+// Line n (0-based) of the history, not NUL-terminated
+const char *history_entry(size_t n, size_t *len) {
+    size_t end = n + 1 < hist.count ? hist.offsets[n + 1] : hist.scanned;
+    *len = end - hist.offsets[n] - 1;
+    return hist.map + hist.offsets[n];
+}
 
-    if (strncmp(input, "submit", 6) == 0) {
-        printf("Error: Pipes are not allowed with submit command\n");
-        return;
-    }
+void history_add(const char *line) {
+    if (hist.fd < 0) return;
+    size_t len = strlen(line);
+    char buf[INPUT_MAX + 1];
+    if (len >= sizeof(buf)) return;
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    // One O_APPEND write keeps lines from concurrent shells whole
+    if (write(hist.fd, buf, len + 1) != (ssize_t)(len + 1)) return;
+    history_scan();
+}
 
-    int max_pipes = 10;  
-    int pipes[10][2];  
-    char *commands[11];  
-    int command_count = 0;
-    int is_background = 0;
+void history_print(size_t n) {
+    size_t len;
+    const char *text = history_entry(n, &len);
+    printf("%5zu  %.*s\n", n + 1, (int)len, text);
+}
 
-    char *bg_check = strrchr(input, '&');
-    if (bg_check != NULL && (bg_check == input + strlen(input) - 1 || *(bg_check + 1) == '\0')) {
-        is_background = 1;
-        *bg_check = '\0'; 
+// Replaces a leading !!, !n, !-n or !prefix event with the line it names, keeping
+// the rest of the input; returns -1 when the event is not in the history
+int expandHistory(char *input, size_t size) {
+    if (input[0] != '!' || input[1] == '\0' || isspace((unsigned char)input[1]) || input[1] == '=') {
+        return 0;
     }
-
-    char *token = strtok(input, "|");
-    while (token != NULL && command_count < max_pipes + 1) {
-        commands[command_count++] = token;
-        token = strtok(NULL, "|");
+    size_t word = strcspn(input + 1, " \t");
+    char *rest = input + 1 + word;
+    long found = -1;
+
+    if (input[1] == '!' && word == 1) {
+        found = (long)hist.count - 1;
+    } else if (isdigit((unsigned char)input[1]) || (input[1] == '-' && isdigit((unsigned char)input[2]))) {
+        long n = atol(input + 1);
+        found = n > 0 ? n - 1 : (long)hist.count + n;
+        if (found >= (long)hist.count) found = -1;
+    } else {
+        for (long i = (long)hist.count - 1; i >= 0; i--) {
+            size_t len;
+            const char *text = history_entry(i, &len);
+            if (len >= word && memcmp(text, input + 1, word) == 0) {
+                found = i;
+                break;
+            }
+        }
+    }
+    if (found < 0) {
+        printf("SimpleShell: %.*s: event not found\n", (int)word + 1, input);
+        return -1;
     }
 
-    pid_t pid = fork();
+    size_t len;
+    const char *text = history_entry(found, &len);
+    char expanded[INPUT_MAX];
+    int n = snprintf(expanded, sizeof(expanded), "%.*s%s", (int)len, text, rest);
+    if (n < 0 || (size_t)n >= size) {
+        printf("SimpleShell: history expansion too long\n");
+        return -1;
+    }
+    memcpy(input, expanded, n + 1);
+    printf("%s\n", input);
+    return 0;
+}
 
-    if (pid == 0) {
-        setsid();
+// history [N | --page P | search <substr>]
+int showCommandHistory(char **args) {
+    if (hist.fd < 0) {
+        printf("History is unavailable (set HOME or SIMPLE_SHELL_HISTFILE)\n");
+        return 1;
+    }
+    history_scan();
 
-        for (int i = 0; i < command_count - 1; i++) {
-            if (pipe(pipes[i]) == -1) {
-                perror("Pipe creation failed");
-                exit(EXIT_FAILURE);
+    if (args[1] != NULL && strcmp(args[1], "search") == 0) {
+        if (args[2] == NULL) {
+            printf("Usage: history search <substr>\n");
+            return 1;
+        }
+        char pattern[INPUT_MAX] = "";
+        for (int i = 2; args[i] != NULL; i++) {
+            size_t used = strlen(pattern);
+            snprintf(pattern + used, sizeof(pattern) - used, "%s%s", i > 2 ? " " : "", args[i]);
+        }
+        // memmem over the mapping, then a binary search in the index for the line number
+        size_t needle = strlen(pattern);
+        const char *p = hist.map, *end = hist.map + hist.scanned;
+        size_t lo = 0;
+        int matches = 0;
+        while (needle > 0 && (p = memmem(p, end - p, pattern, needle)) != NULL) {
+            size_t at = p - hist.map, hi = hist.count;
+            while (hi - lo > 1) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (hist.offsets[mid] <= at) lo = mid;
+                else hi = mid;
             }
+            history_print(lo);
+            matches++;
+            size_t len;
+            const char *text = history_entry(lo, &len);
+            p = text + len + 1;
         }
+        return matches ? 0 : 1;
+    }
 
-        for (int i = 0; i < command_count; i++) {
-            pid_t child_pid = fork();
+    size_t first, last = hist.count;
+    if (args[1] != NULL && strcmp(args[1], "--page") == 0 && args[2] != NULL) {
+        long page = atol(args[2]);
+        first = page > 0 ? (page - 1) * HISTORY_PAGE : 0;
+        if (first > hist.count) first = hist.count;
+        last = first + HISTORY_PAGE < hist.count ? first + HISTORY_PAGE : hist.count;
+    } else {
+        size_t n = args[1] != NULL ? (size_t)atol(args[1]) : HISTORY_PAGE;
+        first = n < hist.count ? hist.count - n : 0;
+    }
+    for (size_t i = first; i < last; i++) {
+        history_print(i);
+    }
+    if (args[1] == NULL && first > 0) {
+        printf("(%zu earlier entries; history --page P or history N for more)\n", first);
+    }
+    return 0;
+}
+void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w <= 0) return;
+        buf += w;
+        len -= w;
+    }
+}
 
-            if (child_pid == 0) {
-                if (i > 0) {
-                    dup2(pipes[i-1][0], STDIN_FILENO);
-                }
+// output <pid> [--tail N] [--follow]
+int handle_output(char **args) {
+    pid_t pid = 0;
+    long tail = -1;
+    int follow = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "--follow") == 0 || strcmp(args[i], "-f") == 0) {
+            follow = 1;
+        } else if ((strcmp(args[i], "--tail") == 0 || strcmp(args[i], "-n") == 0) && args[i + 1] != NULL) {
+            tail = atol(args[++i]);
+        } else {
+            pid = atoi(args[i]);
+        }
+    }
+    if (pid <= 0) {
+        printf("Usage: output <pid> [--tail N] [--follow]\n");
+        return 1;
+    }
 
-                if (i < command_count - 1) {
-                    dup2(pipes[i][1], STDOUT_FILENO);
-                }
+    JobCapture *cap = NULL;
+    for (int i = 0; i < job_count; i++) {
+        if (scheduler_jobs[i].pid == pid) {
+            cap = scheduler_jobs[i].capture;
+            break;
+        }
+    }
+    if (cap == NULL) {
+        printf("Error: no captured output for PID %d (submit with --capture)\n", pid);
+        return 1;
+    }
 
-                for (int j = 0; j < command_count - 1; j++) {
-                    close(pipes[j][0]);
-                    close(pipes[j][1]);
+    char buf[65536];
+    fflush(stdout);
+    pthread_mutex_lock(&cap->lock);
+
+    // Walk back from the end to the newline that precedes the last N lines
+    size_t off = 0;
+    if (tail >= 0) {
+        off = cap->head;
+        long newlines = 0;
+        while (off > 0 && tail > 0) {
+            size_t chunk = off < sizeof(buf) ? off : sizeof(buf);
+            if (capture_read(cap, off - chunk, buf, chunk) < chunk) {
+                off = cap->spilled;
+                break;
+            }
+            size_t k = chunk;
+            int found = 0;
+            for (; k > 0; k--) {
+                // A trailing newline ends the last line rather than starting one
+                if (buf[k - 1] == '\n' && off - chunk + k != cap->head && ++newlines == tail) {
+                    found = 1;
+                    break;
                 }
+            }
+            off -= chunk;
+            if (found) {
+                off += k;
+                break;
+            }
+        }
+    }
 
-                char *args[ARGS_MAX];
-                splitCommandIntoArgs(commands[i], args);
-                execvp(args[0], args);
-                perror("Command execution failed");
-                exit(EXIT_FAILURE);
+    while (1) {
+        while (off < cap->head) {
+            size_t n = capture_read(cap, off, buf, sizeof(buf));
+            if (n == 0) {
+                // Spilled bytes that never reached the disk are skipped
+                off = cap->spilled > off ? cap->spilled : cap->head;
+                continue;
             }
+            off += n;
+            pthread_mutex_unlock(&cap->lock);
+            write_all(STDOUT_FILENO, buf, n);
+            pthread_mutex_lock(&cap->lock);
         }
+        if (!follow || cap->done || received_sigint) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 200 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&cap->changed, &cap->lock, &deadline);
+    }
 
-        for (int i = 0; i < command_count - 1; i++) {
-            close(pipes[i][0]);
-            close(pipes[i][1]);
+    pthread_mutex_unlock(&cap->lock);
+    if (follow && received_sigint) {
+        // Ctrl-C only ends the follow, not the shell
+        received_sigint = 0;
+    }
+    return 0;
+}
+
+// Returns the next line of a -f script or -c string with its newline stripped,
+// refilling from the file a chunk at a time; NULL at the end of input
+char *readLine(LineReader *r) {
+    while (1) {
+        char *nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if (nl == NULL && r->fd != -1) {
+            // Slide the partial line down and read more behind it
+            memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+            r->len -= r->pos;
+            r->pos = 0;
+            if (r->cap - r->len < BATCH_CHUNK) {
+                r->cap = r->cap * 2 > r->len + BATCH_CHUNK ? r->cap * 2 : r->len + BATCH_CHUNK;
+                r->buf = realloc(r->buf, r->cap + 1);
+            }
+            ssize_t n = read(r->fd, r->buf + r->len, r->cap - r->len);
+            if (n > 0) {
+                r->len += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1) perror("read");
+            if (r->fd != STDIN_FILENO) close(r->fd);
+            r->fd = -1;
         }
+        if (nl == NULL && r->pos == r->len) return NULL;
+
+        char *line = r->buf + r->pos;
+        size_t end = nl != NULL ? (size_t)(nl - r->buf) : r->len;
+        r->buf[end] = '\0';
+        r->pos = nl != NULL ? end + 1 : end;
+        r->line_no++;
+        return line;
+    }
+}
 
-        for (int i = 0; i < command_count; i++) {
-            wait(NULL);
+// Copies everything a job wrote to fd, waiting until the output thread sees EOF
+void drain_capture(JobCapture *cap, int fd) {
+    char buf[65536];
+    size_t off = 0;
+    pthread_mutex_lock(&cap->lock);
+    while (1) {
+        while (off < cap->head) {
+            size_t n = capture_read(cap, off, buf, sizeof(buf));
+            if (n == 0) {
+                off = cap->spilled > off ? cap->spilled : cap->head;
+                continue;
+            }
+            off += n;
+            pthread_mutex_unlock(&cap->lock);
+            write_all(fd, buf, n);
+            pthread_mutex_lock(&cap->lock);
         }
+        if (cap->done) break;
+        pthread_cond_wait(&cap->changed, &cap->lock);
+    }
+    pthread_mutex_unlock(&cap->lock);
+}
 
-        exit(EXIT_SUCCESS);
-    } else if (pid < 0) {
-        perror("Fork failed");
-        return;
-    } else {
-        if (is_background) {
-            printf("[%d] %s\n", pid, input);
-            recordCommand(input, pid, is_background);
-        } else {
-            waitpid(pid, NULL, 0);
+// Replaces each {} in the template with input; with no {} anywhere, input is appended.
+// Substituted words are allocated from line_arena.
+char **parallel_argv(char **tmpl, int argc, const char *input, char **out) {
+    int substituted = 0;
+    for (int i = 0; i < argc; i++) {
+        char *at = strstr(tmpl[i], "{}");
+        if (at == NULL) {
+            out[i] = tmpl[i];
+            continue;
+        }
+        size_t in_len = strlen(input);
+        char *arg = arenaAlloc(&line_arena, strlen(tmpl[i]) * (in_len + 1) + 1);
+        char *dst = arg;
+        for (const char *src = tmpl[i]; *src; ) {
+            if (src[0] == '{' && src[1] == '}') {
+                memcpy(dst, input, in_len);
+                dst += in_len;
+                src += 2;
+            } else {
+                *dst++ = *src++;
+            }
         }
+        *dst = '\0';
+        out[i] = arg;
+        substituted = 1;
     }
+    out[argc] = substituted ? NULL : (char *)input;
+    out[argc + 1] = NULL;
+    return out;
 }
 
-void handleInputOutputRedirection(char *input, int direction) {
-    
-    char *filename;
-    int fd;
-    char *args[ARGS_MAX];
+// parallel [-j N] [-p PRIORITY] prog [args with {}] ::: inputs...
+// parallel [-j N] [-p PRIORITY] prog [args with {}] < list
+// Submits one scheduler job per input with at most N in flight, and prints each
+// job's output once it and every job before it have finished.
+int handle_parallel(char **args) {
+    int jobs = 0;
+    char *priority_str = NULL;
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL) jobs = atoi(args[++i]);
+        else if (strcmp(args[i], "-p") == 0 && args[i + 1] != NULL) priority_str = args[++i];
+        else break;
+    }
+    if (args[i] == NULL || strcmp(args[i], ":::") == 0) {
+        printf("Usage: parallel [-j N] [-p PRIORITY] <program> [args with {}] (::: inputs... | < list)\n");
+        return 1;
+    }
 
-    if (direction == 0) {
-        filename = strchr(input, '<') + 1;
-        *strchr(input, '<') = '\0';
+    char **tmpl = &args[i];
+    int argc = 0;
+    while (tmpl[argc] != NULL && strcmp(tmpl[argc], ":::") != 0) argc++;
+
+    char **inputs;
+    size_t n = 0;
+    LineReader list = { .fd = -1 };
+    if (tmpl[argc] != NULL) {
+        inputs = &tmpl[argc + 1];
+        while (inputs[n] != NULL) n++;
     } else {
-        filename = strchr(input, '>') + 1;
-        *strchr(input, '>') = '\0';
+        // readLine slides its buffer on every refill, so each line is copied out
+        size_t cap = 256;
+        list.fd = STDIN_FILENO;
+        inputs = malloc(cap * sizeof(char *));
+        char *line;
+        while ((line = readLine(&list)) != NULL) {
+            if (*line == '\0') continue;
+            if (n == cap) {
+                cap *= 2;
+                inputs = realloc(inputs, cap * sizeof(char *));
+            }
+            inputs[n++] = arenaStrdup(&line_arena, line);
+        }
+        free(list.buf);
     }
 
-    removeLeadingTrailingSpaces(filename);
-    splitCommandIntoArgs(input, args);
+    if (jobs <= 0) {
+        SchedStats st;
+        sched_stats_read(&shared_mem->stats, &st);
+        jobs = st.ncpu > 0 ? st.ncpu
+             : strcmp(global_ncpu, "auto") != 0 ? atoi(global_ncpu)
+             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+
+    SubmitOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.capture = 1;
+    opts.quiet = 1;
+
+    int *slot = arenaAlloc(&line_arena, (n ? n : 1) * sizeof(int));
+    char **job_argv = arenaAlloc(&line_arena, (argc + 2) * sizeof(char *));
+    size_t submitted = 0, printed = 0;
+    int failed = 0;
+    while (printed < n && !received_sigint) {
+        pthread_mutex_lock(&job_lock);
+        int inflight = 0;
+        for (size_t k = printed; k < submitted; k++) {
+            if (slot[k] >= 0 && !scheduler_jobs[slot[k]].completed) inflight++;
+        }
+        pthread_mutex_unlock(&job_lock);
+
+        while (submitted < n && inflight < jobs && submitted < printed + PARALLEL_WINDOW * jobs) {
+            ArenaMark mark = arenaMark(&line_arena);
+            parallel_argv(tmpl, argc, inputs[submitted], job_argv);
+            slot[submitted] = handle_submit(job_argv, priority_str, &opts);
+            arenaRelease(&line_arena, mark);
+            if (slot[submitted] >= 0) inflight++;
+            submitted++;
+        }
+        fflush(stdout);
 
-    fd = (direction == 0) ? open(filename, O_RDONLY) : open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror("File operation failed");
-        return;
+        // Sleep until the oldest job finishes, or any does while more can be submitted
+        pthread_mutex_lock(&job_lock);
+        int can_submit = submitted < n && submitted < printed + PARALLEL_WINDOW * jobs;
+        unsigned long seen = scheduler_completions;
+        while (!received_sigint && slot[printed] >= 0 && !scheduler_jobs[slot[printed]].completed &&
+               !(can_submit && scheduler_completions != seen)) {
+            pthread_cond_wait(&job_changed, &job_lock);
+        }
+        pthread_mutex_unlock(&job_lock);
+
+        while (printed < submitted) {
+            int idx = slot[printed];
+            pthread_mutex_lock(&job_lock);
+            int done = idx < 0 || scheduler_jobs[idx].completed;
+            pthread_mutex_unlock(&job_lock);
+            if (!done) break;
+            if (idx < 0 || scheduler_jobs[idx].exit_status != 0) failed++;
+            if (idx >= 0 && scheduler_jobs[idx].capture != NULL) {
+                drain_capture(scheduler_jobs[idx].capture, STDOUT_FILENO);
+                destroy_capture(scheduler_jobs[idx].capture);
+                scheduler_jobs[idx].capture = NULL;
+            }
+            printed++;
+        }
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        dup2(fd, direction == 0 ? STDIN_FILENO : STDOUT_FILENO);
-        close(fd);
-        execvp(args[0], args);
-        perror("Command execution failed");
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {
-        close(fd);
-        waitpid(pid, NULL, 0);
-    } else {
-        perror("Fork failed");
+    if (received_sigint) {
+        // Ctrl-C abandons the run and its remaining jobs, not the shell
+        for (size_t k = printed; k < submitted; k++) {
+            if (slot[k] >= 0) kill(scheduler_jobs[slot[k]].pid, SIGTERM);
+        }
+        if (job_control) received_sigint = 0;
+        failed = 128 + SIGINT;
     }
+
+    if (tmpl[argc] == NULL) free(inputs);
+    // Like GNU parallel: the number of failed jobs, capped
+    return failed > 101 && failed != 128 + SIGINT ? 101 : failed;
 }
 
-void showCommandHistory() {
-    for (int i = 0; i < history_count; i++) {
-        printf("%d: %s\n", i + 1, command_history[i].command);
+// submit-dag FILE
+// One job per line: "name after priority program [args...]". after is "-" or a comma
+// separated list of names from earlier lines, priority may be "-" for the default, and
+// # starts a comment. The whole file is checked before anything is submitted. Jobs are
+// then forked in file order as long as shared slots are free, and the scheduler holds
+// each one until the jobs it names have exited 0. The rest wait here for slots, like
+// parallel's window, so a DAG larger than MAX_JOBS returns once its last job is
+// submitted; a job whose parent failed is skipped instead of submitted.
+int handle_submit_dag(char **args) {
+    if (args[1] == NULL || args[2] != NULL) {
+        printf("Usage: submit-dag <file>   (lines: name after|- priority|- program [args...])\n");
+        return 1;
+    }
+    int fd = open(args[1], O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Cannot open DAG file");
+        return 1;
+    }
+
+    typedef struct {
+        char *name;
+        char *priority;  // NULL for the default
+        char **argv;
+        int after[MAX_JOB_DEPS];  // indexes of earlier nodes
+        int after_count;
+        int depth;
+        pid_t pid;       // 0 until submitted
+        int index;       // in scheduler_jobs once submitted
+        int skipped;
+    } DagNode;
+    DagNode *nodes = NULL;
+    size_t count = 0, cap = 0;
+
+    // Words are copied out: readLine slides its buffer on every refill
+    LineReader r = { .fd = fd };
+    char *line;
+    int failed = 0, depth = 0;
+    while (!failed && (line = readLine(&r)) != NULL) {
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+
+        char *argv[ARGS_MAX + 1];
+        int argc = 0;
+        char *save;
+        for (char *tok = strtok_r(line, " \t\r", &save); tok != NULL; tok = strtok_r(NULL, " \t\r", &save)) {
+            if (argc == ARGS_MAX) {
+                printf("Error: %s:%ld: too many arguments (max %d)\n", args[1], r.line_no, ARGS_MAX);
+                failed = 1;
+                break;
+            }
+            argv[argc++] = tok;
+        }
+        if (failed) break;
+        argv[argc] = NULL;
+        if (argc == 0) continue;
+        if (argc < 4) {
+            printf("Error: %s:%ld: expected 'name after priority program [args...]'\n", args[1], r.line_no);
+            failed = 1;
+            break;
+        }
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            nodes = realloc(nodes, cap * sizeof(DagNode));
+        }
+        DagNode *node = &nodes[count];
+        memset(node, 0, sizeof(*node));
+        node->depth = 1;
+        if (strcmp(argv[1], "-") != 0) {
+            char *save_dep;
+            for (char *dep = strtok_r(argv[1], ",", &save_dep); dep != NULL; dep = strtok_r(NULL, ",", &save_dep)) {
+                size_t k = 0;
+                while (k < count && strcmp(nodes[k].name, dep) != 0) k++;
+                if (k == count || node->after_count == MAX_JOB_DEPS) {
+                    if (k == count) printf("Error: %s:%ld: '%s' is not a job on an earlier line\n", args[1], r.line_no, dep);
+                    else printf("Error: %s:%ld: a job can wait on at most %d others\n", args[1], r.line_no, MAX_JOB_DEPS);
+                    failed = 1;
+                    break;
+                }
+                node->after[node->after_count++] = k;
+                if (nodes[k].depth + 1 > node->depth) node->depth = nodes[k].depth + 1;
+            }
+            if (failed) break;
+        }
+        for (size_t k = 0; k < count; k++) {
+            if (strcmp(nodes[k].name, argv[0]) == 0) {
+                printf("Error: %s:%ld: job '%s' is defined twice\n", args[1], r.line_no, argv[0]);
+                failed = 1;
+            }
+        }
+        if (failed) break;
+
+        node->name = arenaStrdup(&line_arena, argv[0]);
+        node->priority = strcmp(argv[2], "-") == 0 ? NULL : arenaStrdup(&line_arena, argv[2]);
+        node->argv = arenaAlloc(&line_arena, (argc - 2) * sizeof(char *));
+        for (int i = 3; i <= argc; i++) node->argv[i - 3] = argv[i] ? arenaStrdup(&line_arena, argv[i]) : NULL;
+        if (node->depth > depth) depth = node->depth;
+        count++;
+    }
+    if (r.fd != -1) close(r.fd);
+    free(r.buf);
+    if (failed || count == 0) {
+        if (failed) printf("Error: %s: nothing was submitted\n", args[1]);
+        free(nodes);
+        return failed;
+    }
+
+    SubmitOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    pthread_mutex_lock(&job_lock);
+    opts.dag = ++dag_count;
+    pthread_mutex_unlock(&job_lock);
+    printf("Submitting DAG %d: %zu jobs, longest chain %d jobs\n", opts.dag, count, depth);
+
+    size_t first = 0, submitted = 0, skipped = 0;
+    while (first < count && !received_sigint) {
+        pthread_mutex_lock(&job_lock);
+        unsigned long seen = scheduler_completions;
+        for (size_t k = first; k < count; k++) {
+            DagNode *node = &nodes[k];
+            if (node->pid != 0 || node->skipped) continue;
+
+            // Parents come from earlier lines, so each has been submitted or skipped
+            int waiting = 0;
+            const char *bad = NULL;
+            opts.after_count = 0;
+            for (int d = 0; d < node->after_count; d++) {
+                DagNode *parent = &nodes[node->after[d]];
+                if (parent->pid == 0 && !parent->skipped) waiting = 1;
+                else if (parent->skipped) bad = parent->name;
+                else if (scheduler_jobs[parent->index].completed && scheduler_jobs[parent->index].exit_status != 0) bad = parent->name;
+                else opts.after[opts.after_count++] = parent->pid;
+            }
+            if (bad != NULL) {
+                printf("Skipped DAG job '%s': '%s' did not succeed\n", node->name, bad);
+                node->skipped = 1;
+                skipped++;
+                continue;
+            }
+            if (waiting || alloc_shared_slot() == -1) continue;
+
+            pthread_mutex_unlock(&job_lock);
+            int index = handle_submit(node->argv, node->priority, &opts);
+            pthread_mutex_lock(&job_lock);
+            if (index < 0) {
+                printf("Skipped DAG job '%s': it was not submitted\n", node->name);
+                node->skipped = 1;
+                skipped++;
+                continue;
+            }
+            node->pid = scheduler_jobs[index].pid;
+            node->index = index;
+            submitted++;
+        }
+        while (first < count && (nodes[first].pid != 0 || nodes[first].skipped)) first++;
+        fflush(stdout);
+
+        // Slots free up as jobs finish
+        while (first < count && !received_sigint && scheduler_completions == seen) {
+            pthread_cond_wait(&job_changed, &job_lock);
+        }
+        pthread_mutex_unlock(&job_lock);
+    }
+
+    int status = skipped > 0;
+    if (received_sigint) {
+        // Ctrl-C abandons the DAG: nothing more is submitted and its running jobs stop
+        pthread_mutex_lock(&job_lock);
+        for (size_t k = 0; k < count; k++) {
+            if (nodes[k].pid != 0 && !scheduler_jobs[nodes[k].index].completed) kill(nodes[k].pid, SIGTERM);
+        }
+        pthread_mutex_unlock(&job_lock);
+        printf("DAG %d interrupted after submitting %zu of %zu jobs\n", opts.dag, submitted, count);
+        if (job_control) received_sigint = 0;
+        line_interrupted = 1;
+        status = 128 + SIGINT;
+    } else if (skipped > 0) {
+        printf("DAG %d: %zu jobs submitted, %zu skipped\n", opts.dag, submitted, skipped);
     }
+    free(nodes);
+    return status;
 }
+
 void print_scheduler_statistics() {
     
     static int printed = 0;
     if (printed) return;
     printed = 1;
 
+    // An autotuned slice is reported as where it ended up
+    SchedStats st;
+    sched_stats_read(&shared_mem->stats, &st);
+    int tslice_now = global_tslice > 0 ? global_tslice : st.tslice_us;
+
     printf("\nScheduler Job Statistics:\n");
     printf("%-20s %-10s %-10s %-20s %-20s\n", 
            "Name", "PID", "Priority", "Completion Time", "Wait Time");
@@ -508,7 +3688,7 @@ void print_scheduler_statistics() {
     for (int i = 0; i < job_count; i++) {
         if (scheduler_jobs[i].completed) {
 
-            double slice_time = global_tslice ; 
+            double slice_time = tslice_now ; 
             int p = 5 - scheduler_jobs[i].priority;
              // double completion_time = (MAX_PRIORITY - scheduler_jobs[i].priority + 1) * slice_time * 5;
            double completion_time = scheduler_jobs[i].slices_run * slice_time * p;
@@ -523,19 +3703,118 @@ void print_scheduler_statistics() {
                    wait_time);
         }
     }
+
+    if (st.tslice_auto) {
+        printf("\nTSLICE autotune: %d us after %llu adjustments; last window overhead %.2f%%, p99 wait %lld us\n",
+               st.tslice_us, st.tslice_changes, st.overhead_pct, st.wait_p99_us);
+        unsigned long long k = st.tslice_changes > SLICE_LOG_SIZE ? st.tslice_changes - SLICE_LOG_SIZE : 0;
+        for (; k < st.tslice_changes; k++) {
+            SliceChange *c = &st.slice_log[k % SLICE_LOG_SIZE];
+            printf("  #%-4llu %7d -> %-7d us  overhead %6.2f%%  p99 wait %lld us\n",
+                   k + 1, c->from_us, c->to_us, c->overhead_pct, c->wait_p99_us);
+        }
+    }
+
+    // Whole-DAG makespan runs from the first job's submit to the last one's exit
+    int dag_printed = 0;
+    for (int dag = 1; dag <= dag_count; dag++) {
+        int jobs = 0, failed = 0, unfinished = 0, depth = 0;
+        struct timespec first = {0, 0}, last = {0, 0};
+        double cpu = 0;
+        for (int i = 0; i < job_count; i++) {
+            SchedulerJob *job = &scheduler_jobs[i];
+            if (job->dag != dag) continue;
+            if (jobs++ == 0 || elapsedSeconds(&job->start_mono, &first) > 0) first = job->start_mono;
+            if (job->depth > depth) depth = job->depth;
+            if (!job->completed || job->end_mono.tv_sec == 0) {
+                unfinished++;
+                continue;
+            }
+            if (job->exit_status != 0) failed++;
+            if (elapsedSeconds(&last, &job->end_mono) > 0) last = job->end_mono;
+            cpu += tvSeconds(&job->usage.ru_utime) + tvSeconds(&job->usage.ru_stime);
+        }
+        if (jobs == 0) continue;
+        if (!dag_printed) {
+            printf("\nDAG Makespan:\n");
+            printf("%-6s %-8s %-8s %-14s %-14s %-10s\n", "DAG", "Jobs", "Failed", "Longest chain",
+                   "Makespan (s)", "CPU (s)");
+            dag_printed = 1;
+        }
+        char makespan[32];
+        if (unfinished > 0) snprintf(makespan, sizeof(makespan), "%d running", unfinished);
+        else snprintf(makespan, sizeof(makespan), "%.3f", elapsedSeconds(&first, &last));
+        printf("%-6d %-8d %-8d %-14d %-14s %-10.3f\n", dag, jobs, failed, depth, makespan, cpu);
+    }
+
+    int accounting_printed = 0;
+    for (int i = 0; i < job_count; i++) {
+        SchedulerJob *job = &scheduler_jobs[i];
+        if (!job->completed || job->end_mono.tv_sec == 0) continue;
+        if (!accounting_printed) {
+            printf("\nJob Accounting (wait4):\n");
+            printf("%-20s %-10s %-10s %-10s %-10s %-12s %-14s %-14s\n",
+                   "Name", "PID", "Wall (s)", "User (s)", "Sys (s)", "Max RSS KB",
+                   "Faults maj/min", "CSW vol/invol");
+            accounting_printed = 1;
+        }
+        char faults[32], csw[32];
+        snprintf(faults, sizeof(faults), "%ld/%ld", job->usage.ru_majflt, job->usage.ru_minflt);
+        snprintf(csw, sizeof(csw), "%ld/%ld", job->usage.ru_nvcsw, job->usage.ru_nivcsw);
+        printf("%-20s %-10d %-10.3f %-10.3f %-10.3f %-12ld %-14s %-14s\n",
+               job->name, job->pid, elapsedSeconds(&job->start_mono, &job->end_mono),
+               tvSeconds(&job->usage.ru_utime), tvSeconds(&job->usage.ru_stime),
+               job->usage.ru_maxrss, faults, csw);
+    }
+
+    int header_printed = 0;
+    for (int i = 0; i < job_count; i++) {
+        const char *cg = scheduler_jobs[i].cgroup;
+        if (cg[0] == '\0') continue;
+        if (!header_printed) {
+            printf("\nJob Resource Usage (cgroup v2):\n");
+            printf("%-20s %-10s %-12s %-12s %-12s %-12s %-10s %-10s %-10s\n",
+                   "Name", "PID", "CPU (ms)", "Mem Peak", "IO Read", "IO Write",
+                   "CPU Stall", "Mem Stall", "IO Stall");
+            header_printed = 1;
+        }
+
+        long long usage = read_cgroup_key(cg, "cpu.stat", "usage_usec");
+        long long peak = read_cgroup_value(cg, "memory.peak");
+        if (peak < 0) peak = read_cgroup_value(cg, "memory.current");
+        long long rbytes, wbytes;
+        read_cgroup_io(cg, &rbytes, &wbytes);
+
+        // Stall columns are PSI "some" totals in milliseconds
+        long long cpu_stall = read_cgroup_pressure(cg, "cpu.pressure");
+        long long mem_stall = read_cgroup_pressure(cg, "memory.pressure");
+        long long io_stall = read_cgroup_pressure(cg, "io.pressure");
+        printf("%-20s %-10d %-12lld %-12lld %-12lld %-12lld %-10lld %-10lld %-10lld\n",
+               scheduler_jobs[i].name, scheduler_jobs[i].pid,
+               usage < 0 ? -1 : usage / 1000, peak, rbytes, wbytes,
+               cpu_stall < 0 ? -1 : cpu_stall / 1000,
+               mem_stall < 0 ? -1 : mem_stall / 1000,
+               io_stall < 0 ? -1 : io_stall / 1000);
+    }
 }
 
 void printExecutionSummary() {
 
     printf("\nCommand Execution Summary:\n");
+    if (history_dropped > 0) printf("(%d earlier commands not shown)\n\n", history_dropped);
     for (int i = 0; i < history_count; i++) {
         printf("Command: %s\n", command_history[i].command);
         printf("  PID: %d\n", command_history[i].pid);
         printf("  Start Time: %s", ctime(&command_history[i].start_time));
         if (command_history[i].end_time) {
+            const struct rusage *ru = &command_history[i].usage;
             printf("  End Time: %s", ctime(&command_history[i].end_time));
-            printf("  Duration: %.2f seconds\n", 
-                   difftime(command_history[i].end_time, command_history[i].start_time));
+            printf("  Duration: %.3f seconds\n", 
+                   elapsedSeconds(&command_history[i].start_mono, &command_history[i].end_mono));
+            printf("  CPU: user %.3fs, sys %.3fs  Max RSS: %ld KB\n",
+                   tvSeconds(&ru->ru_utime), tvSeconds(&ru->ru_stime), ru->ru_maxrss);
+            printf("  Page Faults: %ld major, %ld minor  Context Switches: %ld voluntary, %ld involuntary\n",
+                   ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
         } else {
             printf("  (Background process or terminated)\n");
         }
@@ -547,37 +3826,13 @@ void printExecutionSummary() {
 
 }
 
-void cleanupBackgroundProcesses() {
-    int status;
-    pid_t pid;
-    
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        printf("Process %d completed\n", pid); 
-        
-     
-        for (int i = 0; i < job_count; i++) {
-            if (scheduler_jobs[i].pid == pid && !scheduler_jobs[i].completed) {
-                scheduler_jobs[i].end_time = time(NULL);
-                scheduler_jobs[i].completed = 1;
-                scheduler_jobs[i].slices_run = 1;  
-                printf("Job %s (PID %d) completed\n", scheduler_jobs[i].name, pid);  
-                break;
-            }
-        }
-        
-       
-        for (int i = 0; i < history_count; i++) {
-            if (command_history[i].pid == pid && command_history[i].is_background) {
-                printf("[%d] Done    %s\n", pid, command_history[i].command);
-                markCommandAsFinished(pid);
-                break;
-            }
-        }
-    }
-}
-
 void cleanup() {
+    shutting_down = 1;
+    history_save_index();
    
+#ifdef SCHEDULER_EMBEDDED
+    scheduler_stop();
+#endif
     if (scheduler_pid > 0) {
         kill(scheduler_pid, SIGTERM);
         waitpid(scheduler_pid, NULL, 0);
@@ -592,34 +3847,134 @@ void cleanup() {
         }
     }
 
+    unlink(journal_path);
     
-    printExecutionSummary();
+    if (interactive) printExecutionSummary();
+    else if (job_count > 0) print_scheduler_statistics();
+    remove_job_cgroups();
+
+    for (int i = 0; i < job_count; i++) {
+        if (scheduler_jobs[i].capture != NULL) {
+            pthread_mutex_lock(&scheduler_jobs[i].capture->lock);
+            int done = scheduler_jobs[i].capture->done;
+            pthread_mutex_unlock(&scheduler_jobs[i].capture->lock);
+            // The output thread still owns captures whose pipe is open
+            if (done) destroy_capture(scheduler_jobs[i].capture);
+            else if (scheduler_jobs[i].capture->spill_fd != -1) unlink(scheduler_jobs[i].capture->spill_path);
+        }
+    }
 }
 
 
 
+int runCommandLine(char *input) {
+    ensure_scheduler_running(0);
+
+    CommandList *list = parseCommandLine(input);
+    if (list == NULL) return 2;
+    int status = executeCommandList(list);
+    arenaReset(&line_arena);
+    return status;
+}
+
+// Runs a -f script or -c string; the status is that of the last command, as in sh
+int runBatch(LineReader *r, const char *name) {
+    int status = 0;
+    char *line;
+    while (!exit_requested && !received_sigint && (line = readLine(r)) != NULL) {
+        while (isspace((unsigned char)*line)) line++;
+        if (*line == '\0' || *line == '#') continue;
+        if (strlen(line) >= INPUT_MAX) {
+            fprintf(stderr, "%s: line %ld: line too long\n", name, r->line_no);
+            status = 2;
+            continue;
+        }
+        status = runCommandLine(line);
+    }
+    free(r->buf);
+    if (received_sigint) return 128 + SIGINT;
+    return exit_requested ? exit_code : status;
+}
+
 int main(int argc, char *argv[]) {
+    LineReader batch = { .fd = -1 };
+    const char *batch_name = NULL;
+    if (argc >= 3 && strcmp(argv[1], "-f") == 0) {
+        batch_name = argv[2];
+        batch.fd = strcmp(argv[2], "-") == 0 ? STDIN_FILENO : open(argv[2], O_RDONLY | O_CLOEXEC);
+        if (batch.fd == -1) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[2], strerror(errno));
+            return 127;
+        }
+    } else if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+        batch_name = "-c";
+        batch.buf = strdup(argv[2]);
+        batch.len = batch.cap = strlen(argv[2]);
+    }
+    if (batch_name != NULL) {
+        interactive = 0;
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Batch runs may leave NCPU and TSLICE at their defaults
+    static char *defaults[] = { NULL, "auto", NULL, NULL };
+    char tslice_default[16];
+    if (!interactive && argc == 1) {
+        snprintf(tslice_default, sizeof(tslice_default), "%d", DEFAULT_TSLICE);
+        defaults[0] = argv[0];
+        defaults[2] = tslice_default;
+        argv = defaults;
+        argc = 3;
+    }
     if (argc != 3) {
-        fprintf(stderr, "Usage: %s <NCPU> <TSLICE>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-f script | -c commands] <NCPU|auto> <TSLICE|auto>\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "auto") != 0 && atoi(argv[1]) < 1) {
+        fprintf(stderr, "NCPU must be a positive integer or 'auto'\n");
+        return 1;
+    }
+    if (strcmp(argv[2], "auto") != 0 && atoi(argv[2]) < 1) {
+        fprintf(stderr, "TSLICE must be a positive number of microseconds or 'auto'\n");
         return 1;
     }
+    start_reaper();
     struct sigaction sa_chld;
     sa_chld.sa_handler = sigchld_handler;
     sigemptyset(&sa_chld.sa_mask);
-    sa_chld.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sa_chld.sa_flags = SA_RESTART;
     if (sigaction(SIGCHLD, &sa_chld, NULL) == -1) {
         perror("Error setting up SIGCHLD handler");
         exit(1);
     }
-    int ncpu = atoi(argv[1]);
-    global_tslice = atoi(argv[2]);
+    global_ncpu = argv[1];
+    global_tslice = strcmp(argv[2], "auto") == 0 ? 0 : atoi(argv[2]);
+    if (getcwd(startup_dir, sizeof(startup_dir)) == NULL) {
+        perror("getcwd");
+        exit(1);
+    }
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", startup_dir, JOURNAL_PATH);
+    // Dead weight for launchbench -M: launch latency should not depend on shell RSS
+    char *ballast_mb = getenv("SIMPLE_SHELL_BALLAST_MB");
+    if (ballast_mb != NULL && atol(ballast_mb) > 0) {
+        size_t bytes = (size_t)atol(ballast_mb) << 20;
+        char *ballast = malloc(bytes);
+        if (ballast != NULL) memset(ballast, 1, bytes);
+    }
+    if (interactive) history_open();
     init_shared_memory();
+    unlink(journal_path);
 
    
-    launch_scheduler(ncpu, global_tslice);
+    if (interactive) {
+        launch_scheduler(global_ncpu, global_tslice, 0);
+    } else {
+        // Batch runs start the scheduler on the first submit
+        scheduler_died = 1;
+    }
     
     char input[INPUT_MAX];
-    char *args[ARGS_MAX];
 
     struct sigaction sa;
     sa.sa_handler = sigint_handler;
@@ -629,6 +3984,22 @@ int main(int argc, char *argv[]) {
         perror("Error setting up SIGINT handler");
         exit(1);
     }
+    // Taking the terminal back from a job's process group must not stop us
+    signal(SIGTTOU, SIG_IGN);
+    shell_pgid = getpgrp();
+    job_control = interactive && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == shell_pgid;
+    if (job_control) {
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        tcgetattr(STDIN_FILENO, &shell_tmodes);
+    }
+
+    if (!interactive) {
+        int status = runBatch(&batch, batch_name);
+        cleanup();
+        cleanup_shared_memory();
+        return status;
+    }
 
     while (1) {
         if (received_sigint) {
@@ -651,55 +4022,28 @@ int main(int argc, char *argv[]) {
 
         if (strlen(input) == 0) continue;
 
-        
-        if (strcmp(input, "exit") == 0) {
-            
-             cleanup();
-            
-            break;
-        }
+        if (expandHistory(input, sizeof(input)) == -1) continue;
+        history_add(input);
 
-        cleanupBackgroundProcesses();
+        runCommandLine(input);
 
-        
-        char command[INPUT_MAX];
-        char program[INPUT_MAX];
-        if (sscanf(input, "%s %s", command, program) == 2 && strcmp(command, "submit") == 0) {
-            char priority_str[32];
-            
-            if (sscanf(input, "%s %s %s", command, program, priority_str) == 3) {
-                handle_submit(program, priority_str);
-            } else {
-                handle_submit(program, NULL);
-            }
-        }
-        else if (strchr(input, '|') != NULL) {
-            handlePipedCommands(input);
-        } 
-        else if (strchr(input, '<') != NULL) {
-            handleInputOutputRedirection(input, 0);  
-        } 
-        else if (strchr(input, '>') != NULL) {
-            handleInputOutputRedirection(input, 1);  
-        } 
-        else {
-            int is_background = splitCommandIntoArgs(input, args);
-            if (args[0] != NULL) {
-                if (strcmp(args[0], "history") == 0) {
-                    showCommandHistory();
-                } else {
-                    executeCommand(args, is_background);
-                }
-            }
+        if (exit_requested) {
+            cleanup();
+            break;
         }
     }
 
-   
+    shutting_down = 1;
+#ifdef SCHEDULER_EMBEDDED
+    scheduler_stop();
+#endif
     if (scheduler_pid > 0) {
         kill(scheduler_pid, SIGTERM);
         waitpid(scheduler_pid, NULL, 0);
     }
 
     cleanup_shared_memory();
-    return 0;
-}
\ No newline at end of file
+    unlink(journal_path);
+    history_save_index();
+    return exit_code;
+}
\ No newline at end of file